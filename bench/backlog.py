@@ -0,0 +1,77 @@
+#!/usr/bin/env python3
+"""Check that a backlogged world drains in order, and that the BACKLOG hook
+fires once each time the send queue backs up.
+
+A local server stops reading twice while tf sends it a burst of numbered
+lines.  Each burst should back up tf's send queue once (one BACKLOG), and
+every line should arrive exactly once, in order, after the server resumes.
+
+usage:  python3 bench/backlog.py <path to tf> [<lines per burst>]
+        (with TFLIBDIR set if tf isn't installed)
+"""
+
+import os, socket, subprocess, sys, tempfile, threading, time
+
+TF = sys.argv[1]
+N = int(sys.argv[2]) if len(sys.argv) > 2 else 50000
+BURSTS = 2
+PAUSE = 2.0                     # seconds the server stops reading
+PAD = b'.' * 50                 # so a burst outgrows the socket buffers
+
+srv = socket.socket()
+srv.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+srv.setsockopt(socket.SOL_SOCKET, socket.SO_RCVBUF, 4096)  # small window
+srv.bind(('127.0.0.1', 0))
+srv.listen(1)
+port = srv.getsockname()[1]
+result = {'lines': 0, 'bad': 0}
+
+def serve():
+    conn, _ = srv.accept()
+    buf, want = b'', 0
+    for burst in range(BURSTS):
+        time.sleep(PAUSE)       # not reading; tf's queue backs up
+        while want < (burst + 1) * N:
+            data = conn.recv(65536)
+            if not data:
+                return
+            buf += data
+            *lines, buf = buf.split(b'\n')
+            for line in lines:
+                if line.rstrip(b'\r') != b'line %d %s' % (want, PAD):
+                    result['bad'] += 1
+                want += 1
+                result['lines'] += 1
+
+threading.Thread(target=serve, daemon=True).start()
+
+script = """
+/set max_instr=0
+/set max_iter=0
+/def -hBACKLOG backlog_hook = /echo BACKLOG %%*
+/def -i burst = \\
+    /let i=%%1%%; \\
+    /while (i < {2}) /send -wbl line %%i %s%%; /test ++i%%; /done
+/addworld bl 127.0.0.1 %d
+/connect bl
+/repeat -0.5 1 /burst 0 %d
+/repeat -%.1f 1 /burst %d %d
+/repeat -%.1f 1 /quit -y
+""" % (PAD.decode(), port, N, PAUSE + 1.5, N, 2 * N, 2 * PAUSE + 6)
+
+with tempfile.NamedTemporaryFile('w', suffix='.tf', delete=False) as f:
+    f.write(script)
+try:
+    out = subprocess.run([TF, '-n', '-f' + f.name], stdin=subprocess.DEVNULL,
+        stdout=subprocess.PIPE, stderr=subprocess.STDOUT,
+        env=dict(os.environ, TERM='dumb'), timeout=60).stdout
+finally:
+    os.unlink(f.name)
+
+hooks = out.count(b'BACKLOG bl')
+print('lines received in order: %d of %d (%d out of order)' %
+    (result['lines'] - result['bad'], BURSTS * N, result['bad']))
+print('BACKLOG hook calls: %d (expected %d)' % (hooks, BURSTS))
+ok = result['lines'] == BURSTS * N and not result['bad'] and hooks == BURSTS
+print('PASS' if ok else 'FAIL')
+sys.exit(0 if ok else 1)
@@ -0,0 +1,54 @@
+;;;; decode_ansi.tf
+;;;; Microbenchmark for decode_ansi():  decodes a block of typical MUD
+;;;; output (room text, prompt, status, 16-, 256-, and 24-bit color codes)
+;;;; many times, and prints the elapsed time.  The figure includes
+;;;; interpreter overhead, so compare builds, not absolute numbers.
+;;;;
+;;;; usage:  tf -n -f<path>/bench/decode_ansi.tf
+;;;; Run it in a UTF-8 locale to exercise the multibyte path.
+
+/set _bench_iter=200000
+/set max_instr=0
+/test E := char(27)
+
+/test _bench_room := strcat( \
+    E, "[1;36mThe Town Square", E, "[0m", \
+    "You are standing in the middle of a busy town square.  Cobblestones ", \
+    "worn smooth by centuries of traffic stretch away in every direction, ", \
+    "and a fountain gurgles quietly beside a statue of the town's ", \
+    "founder.  Merchants hawk their wares from stalls along the edges.  ", \
+    E, "[33mA rusty iron key", E, "[0m lies here.  ", \
+    E, "[1;31mA city guard", E, "[0m stands here, watching you closely.  ", \
+    E, "[32m[Exits: north east south west up]", E, "[0m  ", \
+    E, "[38;5;208mThe smith's forge glows orange.", E, "[0m ", \
+    E, "[48;5;17m", E, "[38;5;231m Night ", E, "[0m ", \
+    E, "[38;2;255;128;0mA 24-bit sunset.", E, "[m  ", \
+    "Café naïve résumé	column	tab  ", \
+    E, "[1m<", E, "[31m120", E, "[37m/", E, "[31m120hp ", \
+    E, "[34m95", E, "[37m/", E, "[34m95mn ", E, "[32m210", E, "[37m/", \
+    E, "[32m210mv", E, "[37m>", E, "[0m ", \
+    E, "[?25h", E, "[2K", E, "[1;1H", E, "[0;1;4;5;7mall at once", \
+    E, "[22;24;25;27m and off", E, "[0m  ")
+
+;; repeat until the block is 1.3KB
+/while (strlen(_bench_room) < 1300) \
+    /test _bench_room := strcat(_bench_room, _bench_room)%; \
+/done
+/test _bench_room := substr(_bench_room, 0, 1300)
+
+/def -i _bench_decode = \
+    /let _i=%{1}%; \
+    /let _n=0%; \
+    /while (_i > 0) \
+        /test _n += strlen(decode_ansi(_bench_room))%; \
+        /test --_i%; \
+    /done%; \
+    /return _n
+
+/test _bench_t0 := time()
+/test _bench_len := _bench_decode(_bench_iter)
+/test _bench_t1 := time()
+/test echo(strcat("decode_ansi: ", _bench_iter, " x ", strlen(_bench_room), \
+    " bytes in ", _bench_t1 - _bench_t0, "s (", _bench_len, " bytes out)"))
+
+/quit -y
@@ -0,0 +1,40 @@
+;;;; interp.tf
+;;;; Benchmark for the macro interpreter (prog_interpret() and its integer
+;;;; fast path):  computes 12! iteratively and recursively many times with
+;;;; factoral.tf, then solves an 18-disk tower as hanoi.tf does, and prints
+;;;; the elapsed time of each.  Compare builds, not absolute numbers.
+;;;;
+;;;; usage:  tf -n -f<path>/bench/interp.tf
+
+/set max_instr=0
+/set max_recur=0
+/load -q factoral.tf
+
+/def -i _bench_fact = \
+    /let _i=%{1}%; \
+    /while (_i > 0) \
+        /test ifact(12) + rfact(12)%; \
+        /test --_i%; \
+    /done
+
+;; hanoi.tf sends each move to the current world; this copy of its
+;; do_hanoi does the same work, but discards the move instead.
+/def -i _bench_do_hanoi = \
+    /if /@test {1} > 0%; /then \
+        /_bench_do_hanoi $[{1} - 1] %2 %4 %3%;\
+        /test "moves a disk from post %2 to %3"%;\
+        /_bench_do_hanoi $[{1} - 1] %4 %3 %2%;\
+    /endif
+
+/test _bench_t0 := time()
+/_bench_fact 200000
+/test _bench_t1 := time()
+/test echo(strcat("fact:  200000 x ifact(12)+rfact(12) in ", \
+    _bench_t1 - _bench_t0, "s"))
+
+/test _bench_t0 := time()
+/_bench_do_hanoi 18 1 3 2
+/test _bench_t1 := time()
+/test echo(strcat("hanoi: 18 disks in ", _bench_t1 - _bench_t0, "s"))
+
+/quit -y
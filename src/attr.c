@@ -453,6 +453,85 @@ static void set_attr(String *line, int offset, attr_t *starting,
 
 #define ANSI_CSI        (char)0233    /* ANSI terminal Command Sequence Intro */
 
+/* SGR parameter table: parameter n changes attrs to
+ * (attrs & ~sgr[n].clear) | sgr[n].set.  Parameters 38 and 48 (extended
+ * fg/bg color) are handled separately.  Unlisted parameters are ignored.
+ */
+#define SGR_MAX 108
+static struct {
+    attr_t clear, set;
+} sgr[SGR_MAX];
+
+static void init_sgr(void)
+{
+    int i;
+
+    sgr[0].clear = ~(attr_t)0;
+    sgr[1].set = F_BOLD;
+    sgr[3].set = F_ITALIC;
+    sgr[4].set = F_UNDERLINE;
+    sgr[5].set = F_FLASH;
+    sgr[7].set = F_REVERSE;
+    sgr[21].clear = F_BOLD;
+    sgr[22].clear = F_BOLD | F_DIM;
+    sgr[23].clear = F_ITALIC;
+    sgr[24].clear = F_UNDERLINE;
+    sgr[25].clear = F_FLASH;
+    sgr[27].clear = F_REVERSE;
+    sgr[39].clear = F_FGCOLOR;
+    sgr[49].clear = F_BGCOLOR;
+    for (i = 0; i < 8; i++) {
+	sgr[30 + i].clear = F_FGCOLORMASK;
+	sgr[30 + i].set = fgcolor2attr(i);
+	sgr[40 + i].clear = F_BGCOLORMASK;
+	sgr[40 + i].set = bgcolor2attr(i);
+	/* not really ANSI */
+	sgr[90 + i].clear = F_FGCOLORMASK;
+	sgr[90 + i].set = fgcolor2attr(i + 8);
+	sgr[100 + i].clear = F_BGCOLORMASK;
+	sgr[100 + i].set = bgcolor2attr(i + 8);
+    }
+}
+
+#if NCOLORS == 256
+/* nearest xterm 256-color index for a 24-bit color */
+static int rgb2color(int r, int g, int b)
+{
+    static const int level[6] = { 0, 95, 135, 175, 215, 255 };
+    int cr, cg, cb, gray, dcube, dgray, t;
+
+#define cube_index(v)	((v) < 48 ? 0 : (v) < 115 ? 1 : ((v) - 35) / 40)
+#define sq(x)		((x) * (x))
+    cr = cube_index(r);
+    cg = cube_index(g);
+    cb = cube_index(b);
+    dcube = sq(level[cr] - r) + sq(level[cg] - g) + sq(level[cb] - b);
+
+    t = (r + g + b) / 3;
+    gray = t < 8 ? 0 : t > 238 ? 23 : (t - 8 + 5) / 10;
+    t = 8 + 10 * gray;
+    dgray = sq(t - r) + sq(t - g) + sq(t - b);
+#undef cube_index
+#undef sq
+
+    return (dgray < dcube) ? 232 + gray : 16 + 36 * cr + 6 * cg + cb;
+}
+#endif
+
+/* Parse an SGR parameter at *sp.  An empty parameter is 0. */
+static inline int sgr_param(const char **sp)
+{
+    const char *s = *sp;
+    int n = 0;
+
+    while (*s >= '0' && *s <= '9') {
+	if (n < 100000) n = n * 10 + (*s - '0');
+	s++;
+    }
+    *sp = s;
+    return n;
+}
+
 /* Interpret embedded codes from a subset of ansi codes:
  * ansi attribute/color codes are converted to tf character or line attrs;
  * tabs are expanded (if %expand_tabs is on); all other codes are ignored.
@@ -461,11 +540,13 @@ static void set_attr(String *line, int offset, attr_t *starting,
 String *decode_ansi(const char *s, attr_t attrs, int emul, attr_t *final_attrs)
 {
     String *dst;
-    int i, colorstate = 0;
+    const char *p;
+    int i, n, orig_len, param[4], nparam;
+    int mixed = 0;		/* has there been a mid-line attr change? */
     attr_t starting_attrs = attrs;
+    static int sgr_ready = 0;
 #if WIDECHAR
-    const char *start = s;
-    int in_len = strlen(s);
+    const char *end;
     wchar_t wc;
     mbstate_t mbs;
     size_t ret;
@@ -478,120 +559,162 @@ String *decode_ansi(const char *s, attr_t attrs, int emul, attr_t *final_attrs)
 	return Stringnew(s, -1, attrs);
     }
 
-    dst = Stringnew(NULL, 1, 0);
+    if (!sgr_ready) {
+	init_sgr();
+	sgr_ready = 1;
+    }
+
+    /* Output is never longer than input, except for expanded tabs, so
+     * dst rarely needs to grow. */
+    n = strlen(s);
+    dst = Stringnew(NULL, n, 0);
+#if WIDECHAR
+    end = s + n;
+#endif
 
-    for ( ; *s; s++) {
-        if ((emul >= EMUL_ANSI_STRIP) &&
-            (*s == ANSI_CSI || (s[0] == '\033' && s[1] == '[' && s++)))
+    while (*s) {
+	orig_len = dst->len;
+
+	if ((unsigned char)*s >= ' ' && (unsigned char)*s < 0177) {
+	    /* copy a run of printable ascii in one piece */
+	    for (p = s + 1; (unsigned char)*p >= ' ' &&
+		(unsigned char)*p < 0177; p++);
+	    Stringfncat(dst, s, p - s);
+	    s = p;
+
+	} else if ((emul >= EMUL_ANSI_STRIP) &&
+            (*s == ANSI_CSI || (s[0] == '\033' && s[1] == '[')))
         {
-	    /* Start with current value of attrs, and collect attributes from
-	     * ANSI codes.  But we don't write to attrs directly, in case this
-	     * turns out to not be an "m" command. */
+	    /* Collect attributes from the parameters, but don't apply them
+	     * unless this turns out to be an "m" command. */
 	    attr_t new = attrs;
-            if (!*s) break;            /* in case code got truncated */
-            do {
-                s++;
-                i = strtoint(s, &s);
-		if (colorstate < 0) {
+	    int error = 0;
+
+	    s += (*s == ANSI_CSI) ? 1 : 2;
+	    if (*s == '?' || *s == '<' || *s == '=' || *s == '>') {
+		/* private sequence; not SGR */
+		error = 1;
+	    }
+	    do {
+		if (*s == ';' || *s == ':') s++;
+		i = sgr_param(&s);
+		if (error) {
 		    /* ignoring everything after error */
-		} else if (colorstate % 10 == 8) {
-		    if (i == 5) colorstate++;
-		    else colorstate = -1; /* error */
-		} else if (colorstate % 10 == 9) {
-		    if (i < 0 || i > 255)
-			colorstate = -1; /* error */
-		    else {
+		} else if (emul < EMUL_ANSI_ATTR) {
+		    new = 0;
+		} else if (i == 38 || i == 48) { /* not really ANSI */
+		    /* "38;5;N" or "48;5;N" selects an xterm 256-color, and
+		     * "38;2;R;G;B" or "48;2;R;G;B" a 24-bit color, which is
+		     * mapped to the nearest 256-color.  Any deviation from
+		     * these forms invalidates the rest of the control
+		     * sequence.  ':' is accepted as a separator.
+		     */
+		    int color = -1, want = 1;
+		    for (nparam = 0; nparam < want &&
+			(*s == ';' || *s == ':') && s[1]; nparam++)
+		    {
+			s++;
+			param[nparam] = sgr_param(&s);
+			if (nparam == 0)
+			    want = param[0] == 5 ? 2 : param[0] == 2 ? 4 : 1;
+		    }
+		    if (nparam == 2 && param[0] == 5 && param[1] <= 255) {
+			color = param[1];
+		    } else if (nparam == 4 && param[0] == 2 &&
+			param[1] <= 255 && param[2] <= 255 && param[3] <= 255)
+		    {
 #if NCOLORS == 256
-			if (colorstate / 10 == 3)
-			    new = (new & ~F_FGCOLORMASK) | fgcolor2attr(i);
-			else
-			    new = (new & ~F_BGCOLORMASK) | bgcolor2attr(i);
+			color = rgb2color(param[1], param[2], param[3]);
 #endif
-			colorstate = 0;
+		    } else {
+			error = 1;
+			continue;
 		    }
-                } else if (!i || emul < EMUL_ANSI_ATTR) {
-                    new = 0;
-                } else if (i >= 30 && i <= 37) {
-                    new = (new & ~F_FGCOLORMASK) | fgcolor2attr(i - 30);
-                } else if (i >= 40 && i <= 47) {
-                    new = (new & ~F_BGCOLORMASK) | bgcolor2attr(i - 40);
-                } else if (i >= 90 && i <= 97) { /* not really ANSI */
-                    new = (new & ~F_FGCOLORMASK) | fgcolor2attr(i - 90 + 8);
-                } else if (i >= 100 && i <= 107) { /* not really ANSI */
-                    new = (new & ~F_BGCOLORMASK) | bgcolor2attr(i - 100 + 8);
-                } else if (i == 38 || i == 48) { /* not really ANSI */
-		    colorstate = i;
-		    /* Subsequences of the form "38;5;N" or "48;5;N" describe
-		     * fg or bg xterm 256-color controls, where 0<=N<=255.
-		     * Once we see the start of such a subsequence, any
-		     * deviation from the correct form invalidates the rest
-		     * of the control sequence.
-		     */
-                } else switch (i) {
-                    case 1:   new |= F_BOLD;          break;
-                    case 3:   new |= F_ITALIC;        break;
-                    case 4:   new |= F_UNDERLINE;     break;
-                    case 5:   new |= F_FLASH;         break;
-                    case 7:   new |= F_REVERSE;       break;
-                    case 21:  new &= ~F_BOLD;         break;
-                    case 22:  new &= ~(F_BOLD|F_DIM); break;
-                    case 23:  new &= ~F_ITALIC;       break;
-                    case 24:  new &= ~F_UNDERLINE;    break;
-                    case 25:  new &= ~F_FLASH;        break;
-                    case 27:  new &= ~F_REVERSE;      break;
-                    case 39:  new &= ~F_FGCOLOR;      break;
-                    case 49:  new &= ~F_BGCOLOR;      break;
-                    default:  /* ignore it */         break;
-                }
-            } while (s[0] == ';' && s[1]);
-
-            if (!*s) {			/* in case code got truncated */
-		break;
-	    } else if (*s == '?') {	/* ignore ESC [ ? alnum */
-                if (!*++s) break;
-            } else if (*s == 'm') {	/* attribute command */
-                attrs = new;
-            } /* ignore any other CSI command */
+#if NCOLORS == 256
+		    if (i == 38)
+			new = (new & ~F_FGCOLORMASK) | fgcolor2attr(color);
+		    else
+			new = (new & ~F_BGCOLORMASK) | bgcolor2attr(color);
+#endif
+		} else if (i < SGR_MAX) {
+		    new = (new & ~sgr[i].clear) | sgr[i].set;
+		}
+	    } while ((*s == ';' || *s == ':') && s[1]);
+
+	    /* skip to the final byte */
+	    while (*s >= 0x20 && *s <= 0x3F) s++;
+	    if (!*s) break;		/* in case code got truncated */
+	    if (*s == 'm' && !error)	/* attribute command */
+		attrs = new;
+	    s++;			/* ignore any other CSI command */
 
         } else if ((emul >= EMUL_ANSI_STRIP) && (*s == '\033')) {
             /* ignore ESC # digit, ESC ( alnum, ESC ) alnum, and ESC alnum. */
             if (!*++s) break;
             if (*s == '(' || *s == ')' || *s == '#')
                 if (!*++s) break;
+	    s++;
 
-#if WIDECHAR
-        } else if (((ret = mbrtowc(&wc, s, in_len - (s - start), &mbs)) > 0)
-		&& (iswprint(wc) || *s == '\t')) {
-#else
-        } else if (is_print(*s) || *s == '\t') {
-#endif
-	    int orig_len = dst->len;
-	    if (*s == '\t' && expand_tabs) {
+        } else if (*s == '\t') {
+	    if (expand_tabs)
 		Stringnadd(dst, ' ', tabsize - dst->len % tabsize);
-	    } else {
-#if WIDECHAR
-		if (ret <= -2 && ret >= 0) {
-		    int j = 1;
-		    while (j++ < ret) {
-			Stringadd(dst, *s++);
-		    }
-		}
-#endif
-		Stringadd(dst, *s);
-	    }
-	    set_attr(dst, orig_len, &starting_attrs, attrs);
+	    else
+		Stringadd(dst, '\t');
+	    s++;
 
         } else if (*s == '\b') {
 	    /* bug: doesn't handle expanded tabs */
 	    if (dst->len > 0)
 		Stringtrunc(dst, dst->len - 1);
+	    s++;
+	    continue;
 
         } else if (*s == '\07') {
             dst->attrs |= F_BELL;
-        }
+	    s++;
+	    continue;
+
+#if WIDECHAR
+        } else if ((unsigned char)*s >= 0200) {
+	    ret = mbrtowc(&wc, s, end - s, &mbs);
+	    if (ret == (size_t)-1 || ret == (size_t)-2 || ret == 0) {
+		/* invalid or truncated; drop a byte and resync */
+		memset(&mbs, 0, sizeof(mbs));
+		s++;
+		continue;
+	    }
+	    if (iswprint(wc))
+		Stringfncat(dst, s, ret);
+	    s += ret;
+#else
+        } else if (is_print(*s)) {
+	    Stringadd(dst, *s);
+	    s++;
+#endif
+
+	} else {
+	    s++;  /* ignore other control characters */
+	    continue;
+	}
+
+	if (dst->len > orig_len) {
+	    /* As in set_attr():  attrs at the first visible character are
+	     * the starting attrs; a later change makes charattrs. */
+	    if (!mixed && orig_len == 0) {
+		starting_attrs = attrs;
+	    } else if (!mixed && starting_attrs != attrs) {
+		/* First mid-line attr change. */
+		mixed = 1;
+		check_charattrs(dst, orig_len, starting_attrs,
+		    __FILE__, __LINE__);
+	    }
+	    if (mixed)
+		for (i = orig_len; i < dst->len; i++)
+		    dst->charattrs[i] = attrs;
+	}
     }
 
-    if (!dst->charattrs) {
+    if (!mixed) {
         /* No mid-line changes, so apply starting_attrs to entire line */
         dst->attrs |= starting_attrs;
     } else {
@@ -684,25 +807,41 @@ String *attr2str(String *buffer, attr_t attrs)
     return buffer;
 }
 
+/* append data[start..end-1] to buf, doubling any '@' */
+static void cat_escape_at(String *buf, const char *data, int start, int end)
+{
+    const char *at;
+
+    while (start < end) {
+	at = memchr(data + start, '@', end - start);
+	if (!at) {
+	    Stringfncat(buf, data + start, end - start);
+	    break;
+	}
+	Stringfncat(buf, data + start, at - data + 1 - start);
+	Stringadd(buf, '@');
+	start = at - data + 1;
+    }
+}
+
 String *encode_attr(const conString *str, int offset)
 {
-    attr_t oldattrs = 0, attrs;
-    int i;
+    attr_t oldattrs = 0, attrs = 0;
+    int i, runend;
     String *new;
     
     new = Stringnew(NULL, str->len+1, 0);
     if (!str->charattrs) {
 	if (str->attrs)
 	    Stringadd(attr2str(Stringcat(new, "@{"), str->attrs), '}');
-	for (i = offset; i < str->len; i++) {
-	    Stringadd(new, str->data[i]);
-	    if (str->data[i] == '@')
-		Stringadd(new, '@');
-	}
+	cat_escape_at(new, str->data, offset, str->len);
 	if (str->attrs)
 	    Stringcat(new, "@{n}");
     } else {
-	for (i = offset; i < str->len; i++) {
+	for (i = offset; i < str->len; i = runend) {
+	    /* handle each run of identical charattrs at once */
+	    for (runend = i + 1; runend < str->len &&
+		str->charattrs[runend] == str->charattrs[i]; runend++);
 	    attrs = adj_attr(str->attrs, str->charattrs[i]);
 	    if ((attrs ^ oldattrs) & F_HWRITE) {
 		if (!(attrs & F_HWRITE)) {
@@ -723,9 +862,7 @@ String *encode_attr(const conString *str, int offset)
 			'}');
 		}
 	    }
-	    Stringadd(new, str->data[i]);
-	    if (str->data[i] == '@')
-		Stringadd(new, '@');
+	    cat_escape_at(new, str->data, i, runend);
 	    oldattrs = attrs;
 	}
 	if (attrs & F_HWRITE)
@@ -774,8 +911,8 @@ static String *attr2ansi(String *str, attr_t attrs)
 
 String *encode_ansi(const conString *str, int offset)
 {
-    attr_t oldattrs = 0, attrs;
-    int i;
+    attr_t oldattrs = 0, attrs = 0;
+    int i, runend;
     String *new;
     
     new = Stringnew(NULL, str->len+1, 0);
@@ -786,7 +923,10 @@ String *encode_ansi(const conString *str, int offset)
 	if (str->attrs)
 	    Stringcat(new, "\033[m");
     } else {
-	for (i = offset; i < str->len; i++) {
+	for (i = offset; i < str->len; i = runend) {
+	    /* handle each run of identical charattrs at once */
+	    for (runend = i + 1; runend < str->len &&
+		str->charattrs[runend] == str->charattrs[i]; runend++);
 	    attrs = adj_attr(str->attrs, str->charattrs[i]);
 	    if ((attrs ^ oldattrs) & F_HWRITE) {
 		if (!(attrs & F_HWRITE)) {
@@ -807,7 +947,7 @@ String *encode_ansi(const conString *str, int offset)
 			attrs & F_HWRITE), 'm');
 		}
 	    }
-	    Stringadd(new, str->data[i]);
+	    Stringfncat(new, str->data + i, runend - i);
 	    oldattrs = attrs;
 	}
 	if (attrs & F_HWRITE)
@@ -816,3 +956,146 @@ String *encode_ansi(const conString *str, int offset)
     return new;
 }
 
+
+/* Memoized encodings.  A line that is shared (e.g., a history line that is
+ * written to several logs, or a string value passed to encode_ansi()) is
+ * encoded at most once per form; the result is shared with every caller.
+ * The memo holds a link to the line so it can't be freed and its address
+ * reused while it's cached, and it remembers the line's data, charattrs,
+ * length, and attrs so a line that was modified in place is reencoded.
+ * Everything held by the memo is counted against %encode_cache bytes, and
+ * the least recently used entries are dropped to stay under it.
+ */
+#define ENCODE_SLOTS	1024	/* must be a power of 2 */
+
+typedef struct EncodeMemo {
+    conString *line;			/* linked */
+    const char *data;			/* line's contents when encoded */
+    const cattr_t *charattrs;
+    int len;
+    attr_t attrs;
+    attr_t hiliteattrs;			/* %hiliteattr when encoded */
+    conString *enc[2];			/* [0] encode_attr, [1] encode_ansi */
+    long bytes;
+    struct EncodeMemo *prev, *next;	/* LRU list, most recent first */
+} EncodeMemo;
+
+static EncodeMemo *encode_slot[ENCODE_SLOTS];
+static EncodeMemo *encode_mru = NULL, *encode_lru = NULL;
+static long encode_bytes = 0;
+
+#define encode_hash(line) \
+    (((unsigned long)(line) / sizeof(String)) & (ENCODE_SLOTS - 1))
+
+static long string_bytes(const conString *str)
+{
+    long bytes = sizeof(String) + str->size;
+    if (str->charattrs) bytes += str->len * sizeof(cattr_t);
+    return bytes;
+}
+
+static void encode_unlink(EncodeMemo *memo)
+{
+    if (memo->prev) memo->prev->next = memo->next;
+    else encode_mru = memo->next;
+    if (memo->next) memo->next->prev = memo->prev;
+    else encode_lru = memo->prev;
+}
+
+static void encode_forget(EncodeMemo *memo)
+{
+    int i;
+
+    encode_unlink(memo);
+    encode_slot[encode_hash(memo->line)] = NULL;
+    encode_bytes -= memo->bytes;
+    for (i = 0; i < 2; i++)
+	if (memo->enc[i]) conStringfree(memo->enc[i]);
+    conStringfree(memo->line);
+    FREE(memo);
+}
+
+static void encode_trim(long limit)
+{
+    while (encode_lru && encode_bytes > limit)
+	encode_forget(encode_lru);
+}
+
+int ch_encode_cache(Var *var)
+{
+    encode_trim(encode_cache);
+    return 1;
+}
+
+/* Returns the encode_ansi() (if ansi) or encode_attr() form of line, from
+ * the memo if possible.  The result may be shared; callers must not modify
+ * it, and should link and free it (or hand it to newSstr()).
+ */
+conString *encode_line(conString *line, int ansi)
+{
+    EncodeMemo *memo;
+    String *enc;
+    long bytes;
+
+    if (encode_cache <= 0 || !line->dynamic_struct || line->links <= 0)
+	return CS(ansi ? encode_ansi(line, 0) : encode_attr(line, 0));
+
+    memo = encode_slot[encode_hash(line)];
+    if (memo && (memo->line != line || memo->data != line->data ||
+	memo->charattrs != line->charattrs || memo->len != line->len ||
+	memo->attrs != line->attrs || memo->hiliteattrs != hiliteattr))
+    {
+	/* slot collision, or line was changed */
+	encode_forget(memo);
+	memo = NULL;
+    }
+
+    if (memo && memo->enc[ansi]) {
+	if (memo != encode_mru) {
+	    encode_unlink(memo);
+	    memo->prev = NULL;
+	    (memo->next = encode_mru)->prev = memo;
+	    encode_mru = memo;
+	}
+	return memo->enc[ansi];
+    }
+
+    enc = ansi ? encode_ansi(line, 0) : encode_attr(line, 0);
+    bytes = string_bytes(CS(enc)) +
+	(memo ? 0 : sizeof(EncodeMemo) + string_bytes(line));
+    if ((memo ? memo->bytes : 0) + bytes > encode_cache) {
+	/* too big to keep */
+	if (memo) encode_forget(memo);
+	return CS(enc);
+    }
+
+    if (!memo) {
+	memo = XMALLOC(sizeof(EncodeMemo));
+	(memo->line = line)->links++;
+	memo->data = line->data;
+	memo->charattrs = line->charattrs;
+	memo->len = line->len;
+	memo->attrs = line->attrs;
+	memo->hiliteattrs = hiliteattr;
+	memo->enc[0] = memo->enc[1] = NULL;
+	memo->bytes = 0;
+	memo->prev = NULL;
+	if ((memo->next = encode_mru)) encode_mru->prev = memo;
+	else encode_lru = memo;
+	encode_mru = memo;
+	encode_slot[encode_hash(line)] = memo;
+    }
+    (memo->enc[ansi] = CS(enc))->links++;
+    memo->bytes += bytes;
+    encode_bytes += bytes;
+    /* memo is most recent and fits by itself, so this won't drop it */
+    encode_trim(encode_cache);
+    return memo->enc[ansi];
+}
+
+#if USE_DMALLOC
+void free_attr(void)
+{
+    encode_trim(0);
+}
+#endif
@@ -19,5 +19,11 @@ extern String *decode_ansi(const char *src, attr_t attrs, int emul,
 extern String *attr2str(String *dest, attr_t attrs);
 extern String *encode_attr(const conString *str, int offset);
 extern String *encode_ansi(const conString *str, int offset);
+extern conString *encode_line(conString *line, int ansi);
+extern int  ch_encode_cache(Var *var);
+
+#if USE_DMALLOC
+extern void free_attr(void);
+#endif
 
 #endif /* ATTR_H */
@@ -46,6 +46,7 @@ defcmd("EXPORT"      , handle_export_command      , 0)
 defcmd("FEATURES"    , handle_features_command    , 0)
 defcmd("FG"          , handle_fg_command          , 0)
 defcmd("GAG"         , handle_gag_command         , 0)
+defcmd("HASHSTAT"    , handle_hashstat_command    , 0)
 defcmd("HELP"        , handle_help_command        , 0)
 defcmd("HILITE"      , handle_hilite_command      , 0)
 defcmd("HISTSIZE"    , handle_histsize_command    , 0)
@@ -90,9 +91,11 @@ defcmd("SET"         , handle_set_command         , 0)
 defcmd("SETENV"      , handle_setenv_command      , 0)
 defcmd("SH"          , handle_sh_command          , 0)
 defcmd("SHIFT"       , handle_shift_command       , 0)
+defcmd("SOCKSTATS"   , handle_sockstats_command   , 0)
 defcmd("STATUS_ADD"  , handle_status_add_command  , 0)
 defcmd("STATUS_CLEAR", handle_status_clear_command, 0)
 defcmd("STATUS_EDIT" , handle_status_edit_command , 0)
+defcmd("STATUS_PROFILE", handle_status_profile_command, 0)
 defcmd("STATUS_RM"   , handle_status_rm_command   , 0)
 defcmd("SUSPEND"     , handle_suspend_command     , 0)
 defcmd("TRIGGER"     , handle_trigger_command     , 0)  
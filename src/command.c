@@ -151,12 +151,12 @@ int handle_substitute_func(
 struct Value *handle_connect_command(String *args, int offset)
 {
     char *host, *port = NULL;
-    int opt, flags = 0;
+    int opt, flags = 0, multi = 0;
 
     if (login) flags |= CONN_AUTOLOGIN;
     if (quietflag) flags |= CONN_QUIETLOGIN;
 
-    startopt(CS(args), "lqxfb");
+    startopt(CS(args), "lqxfbm");
     while ((opt = nextopt(NULL, NULL, NULL, &offset))) {
         switch (opt) {
             case 'l':  flags &= ~CONN_AUTOLOGIN; break;
@@ -164,9 +164,12 @@ struct Value *handle_connect_command(String *args, int offset)
             case 'x':  flags |= CONN_SSL; break;
             case 'f':  flags |= CONN_FG; break;
             case 'b':  flags |= CONN_BG; break;
+            case 'm':  multi = 1; break;
             default:   return shareval(val_zero);
         }
     }
+    if (multi)
+        return newint(openworlds(args->data + offset, flags));
     host = args->data + offset;
     for (port = host; *port && !is_space(*port); port++);
     if (*port) {
@@ -305,6 +308,22 @@ struct Value *handle_features_command(String *args, int offset)
     }
 }
 
+/* /hashstat: list the size and performance of tf's internal hash tables */
+struct Value *handle_hashstat_command(String *args, int offset)
+{
+    HashTable *table;
+
+    oprintf("TABLE       ENTRIES    SLOTS LOAD GROWS      FINDS PROBES/FIND MAXPROBE");
+    for (table = hashtable_list; table; table = table->next) {
+	oprintf("%-10s %8d %8d %3d%% %5d %10ld %11.2f %8d",
+	    table->name, table->count, table->size,
+	    table->count * 100 / table->size, table->grows, table->finds,
+	    table->finds ? (double)table->probes / table->finds : 0.0,
+	    hash_maxprobe(table));
+    }
+    return shareval(val_one);
+}
+
 struct Value *handle_lcd_command(String *args, int offset)
 {
     char buffer[PATH_MAX + 1], *name;
@@ -48,6 +48,57 @@ conString blankline[1] = { STRING_LITERAL("") };
 # define Sfree(str, ptr)		xfree(MD(str), ptr, file, line)
 #endif
 
+/* Small data buffers are recycled through freelists, one per multiple of
+ * ALLOCSIZE, so the many short-lived Strings made while evaluating macros
+ * and expressions (intermediate values, substitution results, etc) don't
+ * each cost a malloc() and free().  A buffer is classified only by its size,
+ * so any malloc'd buffer of a pooled size can be added to its freelist.
+ */
+#define DATAPOOL_CLASSES	4	/* pool buffers up to 4*ALLOCSIZE bytes */
+
+#if !USE_DMALLOC
+typedef union DataBlock {
+    union DataBlock *next;
+    char data[ALLOCSIZE];
+} DataBlock;
+
+static DataBlock *datapool[DATAPOOL_CLASSES];	/* freelists */
+
+#define datapool_class(str, size) \
+    (!MD(str) && (size) > 0 && (size) % ALLOCSIZE == 0 && \
+    (size) <= DATAPOOL_CLASSES * ALLOCSIZE ? (size) / ALLOCSIZE - 1 : -1)
+
+static char *data_alloc(String *str, int size, const char *file, int line)
+{
+    DataBlock *block;
+    int class = datapool_class(str, size);
+
+    if (class < 0 || !(block = datapool[class]))
+        return Smalloc(str, size);
+    datapool[class] = block->next;
+    return block->data;
+}
+
+static void data_free(String *str, char *data, int size,
+    const char *file, int line)
+{
+    DataBlock *block;
+    int class = datapool_class(str, size);
+
+    if (class < 0) {
+        Sfree(str, data);
+        return;
+    }
+    block = (DataBlock*)data;
+    block->next = datapool[class];
+    datapool[class] = block;
+}
+#else
+/* keep every allocation visible to the debugging allocator */
+# define data_alloc(str, size, file, line)	Smalloc(str, size)
+# define data_free(str, data, size, file, line)	Sfree(str, data)
+#endif
+
 static void  resize(String *str, const char *file, int line);
 
 
@@ -76,6 +127,8 @@ void extend_charattrs(String *str, int oldlen, cattr_t cattrs)
 
 static void resize(String *str, const char *file, int line)
 {
+    int oldsize;
+
     if (!str->resizable) {
         internal_error2(file, line, str->file, str->line, "");
         core("resize: data not resizable", file, line, 0);
@@ -84,8 +137,21 @@ static void resize(String *str, const char *file, int line)
         internal_error2(file, line, str->file, str->line, "");
         core("resize freed string", file, line, 0);
     }
+    oldsize = str->size;
     str->size = (str->len / ALLOCSIZE + 1) * ALLOCSIZE;
 
+#if !USE_DMALLOC
+    if (datapool_class(str, str->size) >= 0 &&
+        datapool[datapool_class(str, str->size)])
+    {
+        char *data = data_alloc(str, str->size, file, line);
+        if (str->data) {
+            memcpy(data, str->data, oldsize < str->size ? oldsize : str->size);
+            data_free(str, str->data, oldsize, file, line);
+        }
+        str->data = data;
+    } else
+#endif
     str->data = Srealloc(str, str->data, str->size);
 
     if (str->charattrs) {
@@ -157,7 +223,7 @@ String *dSinit(
         str->resizable = 1;
         str->dynamic_data = 1;
         str->size = ((len + ALLOCSIZE) / ALLOCSIZE) * ALLOCSIZE;
-        str->data = Smalloc(str, str->size);
+        str->data = data_alloc(str, str->size, file, line);
         str->len = 0;
         str->data[str->len] = '\0';
     } else {
@@ -191,7 +257,7 @@ void dSfree(String *str, const char *file, int line)
 
     if (str->charattrs) Sfree(str, str->charattrs);
     if (str->dynamic_data && str->data)
-        Sfree(str, str->data);
+        data_free(str, str->data, str->size, file, line);
 
     str->size = -42;  /* break lcheck if str is reused without dSinit */
     str->len = 0;
@@ -392,7 +458,7 @@ String *dSfncat(String *dest, const char *src, int n, const char *file, int line
 
 String *Stringstriptrail(String *str)
 {
-    while (is_space(str->data[str->len - 1]))
+    while (str->len > 0 && is_space(str->data[str->len - 1]))
 	--str->len;
     str->data[str->len] = '\0';
     return str;
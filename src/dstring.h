@@ -22,7 +22,7 @@ typedef struct String {
     /* unsigned dynamic_charattrs:1; */	/* charattrs is always dynamic */
     unsigned int resizable: 1;		/* can data be resized? */
     attr_t attrs;		/* whole-line attributes */
-    cattr_t *charattrs;		/* per-character attributes */
+    cattr_t *charattrs;		/* per-character attributes, one per byte */
     struct timeval time;	/* timestamp */
 #if USE_MMALLOC		/* don't waste the space if not using mmalloc */
     void *md;			/* mmalloc descriptor */
@@ -43,7 +43,7 @@ typedef struct conString {
     /* unsigned dynamic_charattrs:1; */	/* charattrs is always dynamic */
     unsigned int resizable: 1;		/* can data be resized? */
     attr_t attrs;		/* whole-line attributes */
-    const cattr_t *charattrs;	/* per-character attributes */
+    const cattr_t *charattrs;	/* per-character attributes, one per byte */
     struct timeval time;	/* timestamp */
 #if USE_MMALLOC		/* don't waste the space if not using mmalloc */
     void *md;			/* mmalloc descriptor */
@@ -83,5 +83,13 @@ bicode(EOL_CRLF,	STRING_LITERAL("CRLF")),
 bicode(EOL_COUNT,	STRING_NULL)
 };
 
+bicode(enum,		static conString enum_send_batch[] = )
+{
+bicode(BATCH_OFF,	STRING_LITERAL("off")),
+bicode(BATCH_BULK,	STRING_LITERAL("bulk")),
+bicode(BATCH_ON,	STRING_LITERAL("on")),
+bicode(BATCH_COUNT,	STRING_NULL)
+};
+
 #undef ENUMEXTERN
 #undef bicode
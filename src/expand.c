@@ -37,12 +37,18 @@ extern struct World   *world_decl;     /* declares struct World */
 
 typedef struct { void *ptr; opcode_t op; } opcmd_t;
 
+typedef struct ArgBuf {		/* reusable argument vector */
+    Arg *vec;
+    int size;
+} ArgBuf;
+
 Value *user_result = NULL;		/* result of last user command */
 int recur_count = 0;			/* expansion nesting count */
 const char *current_command = NULL;
 const conString *argstring = NULL;	/* command argument string */
 Arg *tf_argv = NULL;			/* shifted command argument vector */
 int tf_argc = 0;			/* shifted command/function arg count */
+int argv_pending = -1;			/* offset of argstring not yet split */
 int argtop = 0;				/* top of function argument stack */
 keyword_id_t block = 0;			/* type of current block */
 Value *val_zero = NULL;
@@ -51,6 +57,9 @@ Value *val_blank = NULL;
 
 static const char *oplabel_table[256];
 static int cmdsub_count = 0;		/* cmdsub nesting count */
+static ArgBuf *argbuf = NULL;		/* argument vectors, by recur_count */
+static int argbuf_count = 0;
+static long optimize_saved = 0;		/* instructions removed by optimizer */
 
 
 #define KEYWORD_LENGTH	6	/* length of longest keyword */
@@ -78,6 +87,7 @@ static int macsub(Program *prog, int in_expr);
 static int cmdsub(Program *prog, int in_expr);
 static int percentsub(Program *prog, int subs, String **destp);
 static int expand(Program *prog, String *dest, int subs, opcmd_t *opcmdp);
+static void prog_optimize(Program *prog);
 
 #define is_end_of_statement(p) ((p)[0] == '%' && is_statend((p)[1]))
 #define is_end_of_cmdsub(p) (cmdsub_count && *(p) == ')')
@@ -93,27 +103,33 @@ void init_expand(void)
 #include "opcodes.h"
 }
 
+static void inst_free(Instruction *inst)
+{
+    switch (op_arg_type(inst->op)) {
+    case OPA_STRP:
+	if (inst->arg.str)
+	    conStringfree(inst->arg.str);
+	break;
+    case OPA_VALP:
+	if (inst->arg.val)
+	    freeval(inst->arg.val);
+	break;
+    }
+}
+
 static void prog_free_tail(Program *prog, int start)
 {
     int i;
 
-    for (i = start; i < prog->len; i++) {
-	switch (op_arg_type(prog->code[i].op)) {
-	case OPA_STRP:
-	    if (prog->code[i].arg.str)
-		conStringfree(prog->code[i].arg.str);
-	    break;
-	case OPA_VALP:
-	    if (prog->code[i].arg.val)
-		freeval(prog->code[i].arg.val);
-	    break;
-	}
-    }
+    for (i = start; i < prog->len; i++)
+	inst_free(&prog->code[i]);
+    prog->emitted -= prog->len - start;
     prog->len = start;
 }
 
 void prog_free(Program *prog)
 {
+    if (--prog->links > 0) return;
     prog_free_tail(prog, 0);
     if (prog->code) FREE(prog->code);
     conStringfree(prog->src);
@@ -332,32 +348,31 @@ int handle_command(const conString *orig_cmd_line)
 }
 
 /* stringvec
- * Allocates *<vector> and fills it with locations of start and end of each
- * word in <str>, starting at <offset>.  <vecsize> is a guess of the number of
- * words there will be, or -1.  Returns number of words found, or -1 for error.
- * Freeing *<vector> is the caller's responsibility.
+ * Fills *<vector> with locations of start and end of each word in <str>,
+ * starting at <offset>.  *<vector> is either NULL or a vector of *<vecsize>
+ * Args left by a previous call, which is reused; it is (re)allocated as
+ * needed, and *<vecsize> updated.  Returns number of words found, or -1 for
+ * error.  Freeing *<vector> is the caller's responsibility.
  */
-static int stringvec(const String *str, int offset, Arg **vector, int vecsize)
+static int stringvec(const String *str, int offset, Arg **vector, int *vecsize)
 {
     int count = 0;
     char *start, *next;
     const char *end;
 
-    if (vecsize <= 0) vecsize = 10;
-    if (!(*vector = (Arg *)MALLOC(vecsize * sizeof(Arg)))) {
-	eprintf("Not enough memory for %d word vector", vecsize);
-	return -1;
+    if (!*vector) {
+	if (*vecsize <= 0) *vecsize = 10;
+	if (!(*vector = (Arg *)MALLOC(*vecsize * sizeof(Arg)))) {
+	    eprintf("Not enough memory for %d word vector", *vecsize);
+	    *vecsize = 0;
+	    return -1;
+	}
     }
 
     for (next = str->data + offset; *next; count++) {
-	if (count == vecsize) {
-	    *vector = (Arg*)XREALLOC((char*)*vector, sizeof(Arg)*(vecsize+=10));
-	    if (!*vector) {
-		FREE(*vector);
-		*vector = NULL;
-		eprintf("Not enough memory for %d word vector", vecsize);
-		return -1;
-	    }
+	if (count == *vecsize) {
+	    *vector = (Arg*)XREALLOC((char*)*vector,
+		sizeof(Arg) * (*vecsize += 10));
 	}
 	start = stringarg(&next, &end);
 	(*vector)[count].start = start - str->data;
@@ -367,6 +382,34 @@ static int stringvec(const String *str, int offset, Arg **vector, int vecsize)
     return count;
 }
 
+/* Split the pending argstring of the current macro into tf_argv.  This is
+ * done only when a positional parameter is first needed, into a vector that
+ * is reused by every macro at the same nesting level.
+ */
+int split_argv(void)
+{
+    ArgBuf *ab;
+    int n;
+
+    if (recur_count >= argbuf_count) {
+	n = recur_count + 8;
+	argbuf = XREALLOC(argbuf, n * sizeof(ArgBuf));
+	memset(argbuf + argbuf_count, 0, (n - argbuf_count) * sizeof(ArgBuf));
+	argbuf_count = n;
+    }
+    ab = &argbuf[recur_count];
+    if (!ab->vec) ab->size = 20;
+    tf_argc = stringvec((const String*)argstring, argv_pending,
+	&ab->vec, &ab->size);
+    argv_pending = -1;
+    if (tf_argc < 0) {
+	tf_argc = 0;
+	return 0;
+    }
+    tf_argv = ab->vec;
+    return 1;
+}
+
 Program *compile_tf(conString *src, int srcstart, int subs, int is_expr,
     int optimize)
 {
@@ -383,10 +426,13 @@ Program *compile_tf(conString *src, int srcstart, int subs, int is_expr,
     prog->srcstart = srcstart;
     prog->mark = src->data + srcstart;
     prog->optimize = optimize_user ? optimize : 0;
+    prog->emitted = 0;
+    prog->links = 1;
     ip = src->data + srcstart;
     if (is_expr) {
 	if (expr(prog)) {
 	    if (!*ip) {
+		if (prog->optimize) prog_optimize(prog);
 		if (cecho > invis_flag) prog_dump(prog);
 		return prog;
 	    }
@@ -395,6 +441,7 @@ Program *compile_tf(conString *src, int srcstart, int subs, int is_expr,
     } else {
 	if (list(prog, subs)) {
 	    if (!*ip) {
+		if (prog->optimize) prog_optimize(prog);
 		if (cecho > invis_flag) prog_dump(prog);
 		return prog;
 	    }
@@ -405,13 +452,131 @@ Program *compile_tf(conString *src, int srcstart, int subs, int is_expr,
     return NULL;
 }
 
+/* Programs compiled by macro_run() are kept in an LRU cache keyed by their
+ * source text and everything else that affects compilation, so that text
+ * that is evaluated repeatedly (e.g., by /eval in a loop) is parsed only
+ * once.  Each cached Program compiles its own copy of the text, since
+ * instructions point into their source for mecho and error messages.
+ */
+#define COMPILED_BUCKETS	256	/* must be a power of 2 */
+
+typedef struct Compiled {
+    Program *prog;			/* linked */
+    unsigned int hash;
+    int subs;
+    int flags;				/* compilation options */
+    struct Compiled *hnext;		/* hash chain */
+    struct Compiled *prev, *next;	/* LRU list, most recent first */
+} Compiled;
+
+static Compiled *compiled_bucket[COMPILED_BUCKETS];
+static Compiled *compiled_mru = NULL, *compiled_lru = NULL;
+static int compiled_count = 0;
+static long compiled_hits = 0, compiled_misses = 0;
+
+#define compile_flags() \
+    ((optimize_user ? 1 : 0) | (oldslash ? 2 : 0) | (backslash ? 4 : 0))
+
+static void compiled_unlink(Compiled *c)
+{
+    if (c->prev) c->prev->next = c->next;
+    else compiled_mru = c->next;
+    if (c->next) c->next->prev = c->prev;
+    else compiled_lru = c->prev;
+}
+
+static void compiled_forget(Compiled *c)
+{
+    Compiled **cp;
+
+    for (cp = &compiled_bucket[c->hash & (COMPILED_BUCKETS-1)]; *cp != c;
+	cp = &(*cp)->hnext);
+    *cp = c->hnext;
+    compiled_unlink(c);
+    compiled_count--;
+    prog_free(c->prog);
+    FREE(c);
+}
+
+static void compiled_trim(int limit)
+{
+    while (compiled_lru && compiled_count > limit)
+	compiled_forget(compiled_lru);
+}
+
+int ch_compile_cache(Var *var)
+{
+    compiled_trim(compile_cache);
+    return 1;
+}
+
+long compiled_info(const char *field)
+{
+    if (cstrcmp(field, "hits") == 0) return compiled_hits;
+    if (cstrcmp(field, "misses") == 0) return compiled_misses;
+    if (cstrcmp(field, "size") == 0) return compiled_count;
+    if (cstrcmp(field, "saved") == 0) return optimize_saved;
+    return -1;
+}
+
+/* Returns a linked Program for body, from the cache if possible. */
+static Program *compile_cached(conString *body, int bodystart, int subs)
+{
+    Compiled *c;
+    Program *prog;
+    const char *text = body->data + bodystart;
+    unsigned int hash;
+    int flags;
+
+    if (compile_cache <= 0 || cecho > invis_flag)
+	return compile_tf(body, bodystart, subs, 0, 0);
+
+    hash = hash_string(text);
+    flags = compile_flags();
+    for (c = compiled_bucket[hash & (COMPILED_BUCKETS-1)]; c; c = c->hnext) {
+	if (c->hash == hash && c->subs == subs && c->flags == flags &&
+	    strcmp(c->prog->src->data, text) == 0)
+	{
+	    compiled_hits++;
+	    if (c != compiled_mru) {
+		compiled_unlink(c);
+		c->prev = NULL;
+		(c->next = compiled_mru)->prev = c;
+		compiled_mru = c;
+	    }
+	    c->prog->links++;
+	    return c->prog;
+	}
+    }
+
+    compiled_misses++;
+    prog = compile_tf(CS(Stringnew(text, -1, 0)), 0,
+	subs, 0, 1);
+    if (!prog) return NULL;
+
+    c = XMALLOC(sizeof(Compiled));
+    (c->prog = prog)->links++;
+    c->hash = hash;
+    c->subs = subs;
+    c->flags = flags;
+    c->hnext = compiled_bucket[hash & (COMPILED_BUCKETS-1)];
+    compiled_bucket[hash & (COMPILED_BUCKETS-1)] = c;
+    c->prev = NULL;
+    if ((c->next = compiled_mru)) compiled_mru->prev = c;
+    else compiled_lru = c;
+    compiled_mru = c;
+    compiled_count++;
+    compiled_trim(compile_cache);
+    return prog;
+}
+
 int macro_run(conString *body, int bodystart, String *args, int offset,
     int subs, const char *name)
 {
     Program *prog;
     int result;
 
-    if (!(prog = compile_tf(body, bodystart, subs, 0, 0))) return 0;
+    if (!(prog = compile_cached(body, bodystart, subs))) return 0;
     result = prog_run(prog, args, offset, name, 0);
     prog_free(prog);
     return result;
@@ -469,6 +634,88 @@ static void do_mecho(const Program *prog, int i)
     }
 }
 
+/* Value of an operand of an integer fast path operation, or NULL. */
+static inline const Value *int_operand(const Value *val)
+{
+    if (val->type == TYPE_ID)
+	val = hgetnearestvarval(val);
+    return (val && val->type == TYPE_INT) ? val : NULL;
+}
+
+/* Fast path for binary arithmetic and comparison operators with plain
+ * integer operands, the most common case in loops and counters.  Results
+ * must be identical to reduce_arithmetic()'s, so anything unusual (overflow,
+ * division by zero, other types) returns 0 and is left to reduce().
+ */
+static int reduce_int(opcode_t op)
+{
+    const Value *a, *b;
+    Value *val;
+    long x, y, r;
+    int i;
+
+    switch (op) {
+    case '+': case '-': case '*': case '/': case '<': case '>':
+    case OP_EQUAL: case OP_NOTEQ: case OP_GTE: case OP_LTE:
+	break;
+    default:
+	return 0;
+    }
+    if (!(a = int_operand(opd(2))) || !(b = int_operand(opd(1))))
+	return 0;
+    x = a->u.ival;
+    y = b->u.ival;
+
+    switch (op) {
+    case '+':
+    case '-':
+	/* int, not long, as in reduce_arithmetic() */
+	{
+	    int int0 = x, int1 = y, sum, neg0 = int0 < 0, neg1;
+	    if (op == '-') {
+		neg1 = int1 >= 0;
+		sum = int0 - int1;
+	    } else {
+		neg1 = int1 < 0;
+		sum = int0 + int1;
+	    }
+	    if (neg0 == neg1 && (sum < 0) != neg0)
+		return 0; /* overflow, promotes to float */
+	    r = sum;
+	}
+	break;
+    case '*':
+	i = x * y;
+	if (i != (double)x * (double)y)
+	    return 0; /* overflow, promotes to float */
+	r = i;
+	break;
+    case '/':
+	if (!(i = y))
+	    return 0; /* let reduce() complain */
+	r = x / i;
+	break;
+    case '<':      r = x < y;   break;
+    case '>':      r = x > y;   break;
+    case OP_EQUAL: r = x == y;  break;
+    case OP_NOTEQ: r = x != y;  break;
+    case OP_GTE:   r = x >= y;  break;
+    default:       r = x <= y;  break; /* OP_LTE */
+    }
+
+    val = opd(2);
+    if (val->type == TYPE_INT && val->count == 1 && !val->sval) {
+	/* reuse the left operand, which nothing else refers to */
+	val->u.ival = r;
+	freeval(popval());
+    } else {
+	freeval(popval());
+	freeval(popval());
+	stack[stacktop++] = newint(r);
+    }
+    return 1;
+}
+
 Value *prog_interpret(const Program *prog, int in_expr)
 {
     Value *val, *val2, *result = NULL;
@@ -501,21 +748,29 @@ Value *prog_interpret(const Program *prog, int in_expr)
     stackbot = stacktop;
 
     for (cip = 0; cip < prog->len; cip++) {
-	if (exiting) break;
-	if (interrupted()) {
-	    eprintf("Macro execution interrupted.");
-	    goto prog_interpret_exit;
+	if (exiting || have_pending_signals) {
+	    if (exiting) break;
+	    if (interrupted()) {
+		eprintf("Macro execution interrupted.");
+		goto prog_interpret_exit;
+	    }
 	}
-	if (max_instr > 0 && instruction_count > max_instr) {
+	if (instruction_count++ > max_instr && max_instr > 0) {
 	    eprintf("instruction count exceeded %max_instr (%d).", max_instr);
 	    goto prog_interpret_exit;
 	}
-	instruction_count++;
 	op = prog->code[cip].op;
-	if (mecho > invis_flag) do_mecho(prog, cip);
-	if (iecho > invis_flag) inst_dump(prog, cip, 'i');
+	if (mecho > invis_flag || iecho > invis_flag) {
+	    if (mecho > invis_flag) do_mecho(prog, cip);
+	    if (iecho > invis_flag) inst_dump(prog, cip, 'i');
+	}
+
+	if (argv_pending >= 0 && op_is_posparm(op) && !split_argv())
+	    goto prog_interpret_exit;
 
 	if (op_type_is(op, EXPR)) {
+	    if (prog->code[cip].arg.i == 2 && reduce_int(op))
+		continue;
 	    if (!reduce(op, prog->code[cip].arg.i))
 		goto prog_interpret_exit;
 	    continue;
@@ -563,7 +818,7 @@ Value *prog_interpret(const Program *prog, int in_expr)
 	case OP_SETENV:
 	    /* no_arg and constr were set by OP_ARG */
 	    do_set(prog->code[cip].arg.val->name,
-		prog->code[cip].arg.val->u.hash,
+		prog->code[cip].arg.val->u.id.hash,
 		constr, 0, op == OP_SETENV, op == OP_LET);
 	    if (no_arg) Stringtrunc(buf, 0);
 	    break;
@@ -583,7 +838,7 @@ Value *prog_interpret(const Program *prog, int in_expr)
 	    /* no_arg and constr were set by OP_ARG */
 	    str = execute_start(constr, &old_cmd); /*XXX optimize: don't dup buf */
 	    execute_macro(prog->code[cip].arg.val->name,
-		prog->code[cip].arg.val->u.hash, str, 0);
+		prog->code[cip].arg.val->u.id.hash, str, 0);
 	    execute_end(old_cmd, !(op & OPF_NEG), str);
 	    if (no_arg) Stringtrunc(buf, 0);
 	    setup_next_io();
@@ -943,8 +1198,7 @@ prog_interpret_exit:
 int prog_run(const Program *prog, const String *args, int offset,
     const char *name, int kbnumlocal)
 {
-    Arg *true_argv = NULL;		/* unshifted argument vector */
-    int saved_cmdsub, saved_argc, saved_argtop;
+    int saved_cmdsub, saved_argc, saved_argtop, saved_argv_pending;
     Arg *saved_argv;
     const conString *saved_argstring;
     const char *saved_command;
@@ -961,6 +1215,7 @@ int prog_run(const Program *prog, const String *args, int offset,
     saved_argstring = argstring;
     saved_argc = tf_argc;
     saved_argv = tf_argv;
+    saved_argv_pending = argv_pending;
     saved_argtop = argtop;
     saved_tfin = tfin;
     saved_tfout = tfout;
@@ -977,18 +1232,16 @@ int prog_run(const Program *prog, const String *args, int offset,
 
     if (args) {
         argstring = (const conString*)args;
-	tf_argc = stringvec(args, offset, &tf_argv, 20);
-        true_argv = tf_argv;
+	argv_pending = offset;	/* split by need_argv() */
+	tf_argc = 0;
+	tf_argv = NULL;
         argtop = 0;
     }
        /* else, leave argstring, tf_argv, and tv_argc alone, so /eval body
         * inherits positional parameters */
 
-    if (tf_argc >= 0) {
-        if (!prog_interpret(prog, !name)) set_user_result(NULL);
-    }
+    if (!prog_interpret(prog, !name)) set_user_result(NULL);
 
-    if (true_argv) FREE(true_argv);
     popvarscope();
 
     tfin = saved_tfin;
@@ -997,6 +1250,7 @@ int prog_run(const Program *prog, const String *args, int offset,
     cmdsub_count = saved_cmdsub;
     tf_argc = saved_argc;
     tf_argv = saved_argv;
+    argv_pending = saved_argv_pending;
     argstring = saved_argstring;
     argtop = saved_argtop;
     current_command = saved_command;
@@ -1056,6 +1310,7 @@ static void vcode_add(Program *prog, opcode_t op, int use_mark, va_list ap)
 
     inst = &prog->code[prog->len];
     prog->len++;
+    prog->emitted++;
     inst->start = inst->end = NULL;
     inst->op = op;
 
@@ -1079,8 +1334,15 @@ static void vcode_add(Program *prog, opcode_t op, int use_mark, va_list ap)
 #if 1 /* optimizer */
 #define inst_is_const(inst) \
     ((inst)->op == OP_PUSH && (inst)->arg.val->type != TYPE_ID)
+#define inst_is_pure_call(inst) \
+    ((inst)->op == OP_FUNC && inst_is_const((inst) - (inst)->arg.i) && \
+    pure_function((inst)[-(inst)->arg.i].arg.val))
 
     while (1) {
+	if (prog->len == 0) {
+	    /* Everything was optimized away, e.g. {PUSH INT 1; JZ x;} */
+	    return;
+	}
 	if (inst->comefroms) {
 	    /* Something jumps to this instruction, so we can't consolidate it
 	     * with any instruction before it. */
@@ -1093,21 +1355,34 @@ static void vcode_add(Program *prog, opcode_t op, int use_mark, va_list ap)
 	     * constant operands can be reduced at compile time.
 	     */
 	    /* e.g. {PUSH 3; PUSH 4; +;} to {PUSH 7} */
-	    if (!op_has_sideeffect(inst->op)) {
-		int i, n;
+	    /* e.g. {PUSH FUNC strlen; PUSH "abc"; FUNC 2} to {PUSH 3} */
+	    if (!op_has_sideeffect(inst->op) || inst_is_pure_call(inst)) {
+		int i, n, ok;
 		int old_stacktop = stacktop;
+		TFILE *saved_tferr;
 		n = inst->arg.i;
 		for (i = prog->len - n - 1; i < prog->len - 1; i++) {
 		    if (!inst_is_const(prog->code+i) || prog->code[i+1].comefroms)
 			return;
 		}
+		/* The instructions keep their operands until reduce()
+		 * succeeds, so the code is intact if it fails.  Errors are
+		 * not printed here; if the code is ever run, it will fail
+		 * and report them then (e.g., mod(1,0) in an untaken branch
+		 * is not an error). */
 		for (i = prog->len - n - 1; i < prog->len - 1; i++) {
 		    if (!pushval(prog->code[i].arg.val))
 			goto const_expr_error;
-		    prog->code[i].arg.val = NULL;
+		    prog->code[i].arg.val->count++;
 		}
-		if (!reduce(inst->op, n))
+		saved_tferr = tferr;
+		tferr = NULL;
+		ok = reduce(inst->op, n);
+		tferr = saved_tferr;
+		if (!ok)
 		    goto const_expr_error;
+		for (i = prog->len - n - 1; i < prog->len - 1; i++)
+		    freeval(prog->code[i].arg.val);
 		prog->len -= n;
 		inst = &prog->code[prog->len - 1];
 		/* inst->op = OP_PUSH; */ /* already true */
@@ -1222,6 +1497,17 @@ static void vcode_add(Program *prog, opcode_t op, int use_mark, va_list ap)
 			inst--;
 		    }
 		    continue;
+		} else if (inst[-1].op == OP_DUP && prog->len > 2 &&
+		    !inst[-1].comefroms && inst_is_const(inst-2) &&
+		    !valbool(inst[-2].arg.val) == !(inst->op & OPF_NEG))
+		{
+		    /* the jump of a constant "&" or "|" is always taken */
+		    /* e.g., {PUSH INT 0; DUP 1; JZ x;} to {PUSH INT 0; JUMP x;} */
+		    prog->len--;
+		    inst--;
+		    inst->op = OP_JUMP;
+		    inst->arg.i = inst[1].arg.i;
+		    continue;
 		}
 	    }
 	    return;
@@ -1255,6 +1541,99 @@ static void vcode_add(Program *prog, opcode_t op, int use_mark, va_list ap)
 #endif /* optimizer */
 }
 
+#define jump_dest(prog, n) \
+    ((prog)->code[n].arg.i < 0 ? (prog)->len : (prog)->code[n].arg.i)
+
+/* Whole-program pass, after vcode_add() has done what it can locally:
+ * thread jumps to unconditional jumps through to their final destination,
+ * then remove unreachable code (e.g., the body of "/if (0)") and jumps to
+ * the next remaining instruction.
+ */
+static void prog_optimize(Program *prog)
+{
+    int i, j, dest, hops, n;
+    char *live;
+    int *addr;
+
+    if (prog->len == 0) return;
+    live = XMALLOC(prog->len);
+    addr = XMALLOC((prog->len + 1) * sizeof(int));
+
+    for (i = 0; i < prog->len; i++) {
+	if (!op_type_is(prog->code[i].op, JUMP) || prog->code[i].arg.i < 0)
+	    continue;
+	dest = prog->code[i].arg.i;
+	for (hops = 0; hops < prog->len && dest < prog->len &&
+	    prog->code[dest].op == OP_JUMP && !prog->code[dest].start; hops++)
+	{
+	    dest = jump_dest(prog, dest);
+	}
+	prog->code[i].arg.i = dest;
+    }
+
+    /* mark reachable instructions, using addr[] as a stack of entry points */
+    memset(live, 0, prog->len);
+    n = 0;
+    addr[n++] = 0;
+    while (n > 0) {
+	for (i = addr[--n]; i < prog->len && !live[i]; i++) {
+	    live[i] = 1;
+	    if (op_type_is(prog->code[i].op, JUMP)) {
+		dest = jump_dest(prog, i);
+		if (dest < prog->len && !live[dest])
+		    addr[n++] = dest;
+		if (prog->code[i].op == OP_JUMP)
+		    break;
+	    } else if (prog->code[i].op == OP_RETURN ||
+		prog->code[i].op == OP_RESULT)
+	    {
+		break;
+	    }
+	}
+    }
+
+    for (i = prog->len - 1; i >= 0; i--) {
+	if (!live[i] || prog->code[i].op != OP_JUMP || prog->code[i].start)
+	    continue;
+	dest = jump_dest(prog, i);
+	for (j = i + 1; j < dest && !live[j]; j++);
+	if (j == dest)
+	    live[i] = 0;	/* jump to next live instruction */
+    }
+
+    for (n = i = 0; i < prog->len; i++) {
+	addr[i] = n;
+	if (live[i]) n++;
+    }
+    addr[prog->len] = n;
+
+    for (i = 0; i < prog->len; i++) {
+	if (!live[i]) {
+	    inst_free(&prog->code[i]);
+	    continue;
+	}
+	prog->code[addr[i]] = prog->code[i];
+	if (op_type_is(prog->code[i].op, JUMP) && prog->code[i].arg.i >= 0)
+	    prog->code[addr[i]].arg.i = addr[prog->code[i].arg.i];
+    }
+    memset(&prog->code[n], 0, (prog->len - n) * sizeof(Instruction));
+    prog->len = n;
+
+    for (i = 0; i < prog->len; i++)
+	prog->code[i].comefroms = 0;
+    for (i = 0; i < prog->len; i++) {
+	if (op_type_is(prog->code[i].op, JUMP) && prog->code[i].arg.i >= 0 &&
+	    prog->code[i].arg.i < prog->len)
+	{
+	    prog->code[prog->code[i].arg.i].comefroms++;
+	}
+    }
+
+    optimize_saved += prog->emitted - prog->len;
+    FREE(live);
+    FREE(addr);
+}
+
 void code_add(Program *prog, opcode_t op, ...)
 {
     va_list ap;
@@ -1403,7 +1782,8 @@ static int list(Program *prog, int subs)
 		oldlen = prog->len;
 		code_add(prog, is_a_condition ? OP_JZ : OP_JRZ, -1);
 		code_mark(prog, ip);
-		if (prog->len > oldlen) /* code was emitted */
+		/* {PUSH 0; JZ} becomes {JUMP}, but {PUSH 1; JZ} becomes {} */
+		if (prog->len >= oldlen) /* jump was emitted */
 		    jump_point = prog->len - 1;
 		else /* code was completely optimized away */
 		    jump_point = - 1;
@@ -1480,12 +1860,13 @@ static int list(Program *prog, int subs)
                     block = oldblock;
                     goto list_exit;
                 }
+		oldlen = prog->len;
 		code_add_nomecho(prog, is_a_condition ? OP_JZ : OP_JRZ,
 		    ENDIF_PLACEHOLDER);
 		code_mark(prog, ip);
-		if (prog->len > 0 &&
-		    op_type_is(prog->code[prog->len - 1].op, JUMP))
-		{
+		/* Don't just test for a JUMP at the end; if the jump was
+		 * optimized away, that could be the JUMP of a preceeding ELSEIF. */
+		if (prog->len >= oldlen) {
 		    jump_point = prog->len - 1;
 		} else { /* jump was completely optimized away */
 		    jump_point = -1;
@@ -1814,7 +2195,7 @@ static int expand(Program *prog, String *dest, int subs, opcmd_t *opcmdp)
 		    /* MACRO: ptr is ID name */
 		    Value *val = newid(dest->data + i, dest->len - i);
 		    if (dest->data[i] == '#') /* macro_hash() */
-			val->u.hash = atoi(dest->data + i + 1);
+			val->u.id.hash = atoi(dest->data + i + 1);
 		    opcmdp->ptr = val;
 		    opcmdp->op = OP_MACRO;
 		}
@@ -2224,6 +2605,7 @@ struct Value *handle_shift_command(String *args, int offset)
 
     count = (args->len - offset) ? atoi(args->data + offset) : 1;
     if (count < 0) return shareval(val_zero);
+    if (!need_argv()) return shareval(val_zero);
     if ((error = (count > tf_argc))) count = tf_argc;
     tf_argc -= count;
     if (tf_argv) {  /* true if macro was called as command, not as function */
@@ -2235,10 +2617,14 @@ struct Value *handle_shift_command(String *args, int offset)
 #if USE_DMALLOC
 void free_expand()
 {
+    compiled_trim(0);
     freeval(user_result);
     freeval(val_blank);
     freeval(val_one);
     freeval(val_zero);
+    while (argbuf_count)
+	if (argbuf[--argbuf_count].vec) FREE(argbuf[argbuf_count].vec);
+    if (argbuf) FREE(argbuf);
 }
 #endif
 
@@ -32,6 +32,8 @@ extern struct Program *compile_tf(conString *body, int bodystart, int subs,
     int is_expr, int optimize);
 extern int macro_run(conString *body, int boffset, String *args, int offset,
     int subs, const char *name);
+extern int ch_compile_cache(Var *var);
+extern long compiled_info(const char *field);
 extern Value *prog_interpret(const Program *prog, int in_expr);
 extern String *do_mprefix(void);
 extern const char **keyword(const char *id);
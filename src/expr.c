@@ -56,10 +56,11 @@ extern struct World   *world_decl;     /* declares struct World */
 typedef struct ExprFunc {
     const char *name;           /* name invoked by user */
     unsigned min, max;          /* allowable argument counts */
+    int pure;                   /* may be evaluated at compile time */
 } ExprFunc;
 
 static ExprFunc functab[] = {
-#define funccode(name, pure, min, max)  { #name, min, max }
+#define funccode(name, pure, min, max)  { #name, min, max, pure }
 #include "funclist.h"
 #undef funccode
 };
@@ -111,6 +112,12 @@ Value *expr_value_safe(Program *prog)
     return prog_interpret(prog, 1);
 }
 
+/* Can a call to func with constant arguments be folded into a constant? */
+int pure_function(const Value *func)
+{
+    return func->type == TYPE_FUNC && ((const ExprFunc*)func->u.p)->pure;
+}
+
 
 #if !NO_FLOAT
 Value *newfloat_fl(double f, const char *file, int line)
@@ -185,14 +192,12 @@ Value *newSstr_fl(conString *str, const char *file, int line)
 Value *newid_fl(const char *id, int len, const char *file, int line)
 {
     Value *val;
-    char *new;
 
     val = newval_fl(file, line);
     val->type = TYPE_ID;
-    new = strncpy((char *)xmalloc(NULL, len + 1, file, line), id, len);
-    new[len] = '\0';
-    val->name = new;
-    val->u.hash = hash_string(new);     /* cache hashkey to speed lookup */
+    val->name = intern(id, len);
+    val->u.id.hash = interned_hash(val->name); /* cache hashkey for lookup */
+    val->u.id.ref.var = NULL;
     return val;
 }
 
@@ -270,7 +275,7 @@ void freeval_fl(Value *val, const char *file, int line)
     assert(val->count == 0); 
     clearval_fl(val, file, line);
     if (val->name) {
-        xfree(NULL, (void*)val->name, file, line);
+        unintern(val->name);
         val->name = NULL;
     }
     pfree_fl(val, valpool, u.next, file, line);
@@ -908,14 +913,14 @@ static Value *function_switch(const ExprFunc *func, int n, const char *parent)
             return newint(winlines());
 
         case FN_encode_ansi:
-            return newSstr(CS(encode_ansi(opdstr(n-0), 0)));
+            return newSstr(encode_line(opdstr(n-0), TRUE));
 
         case FN_decode_ansi:
             constr = CS(decode_ansi(opdstd(n), 0, EMUL_ANSI_ATTR, NULL));
             return constr ? newSstr(constr) : shareval(val_blank);
 
         case FN_encode_attr:
-            return newSstr(CS(encode_attr(opdstr(n-0), 0)));
+            return newSstr(encode_line(opdstr(n-0), FALSE));
 
         case FN_decode_attr:
             {
@@ -1299,6 +1304,17 @@ static Value *function_switch(const ExprFunc *func, int n, const char *parent)
             }
             return newstr(str, -1);
 
+        case FN_sockstat:
+            {
+                Value *val;
+                ptr = opdstd(1);
+                if (!(val = sockstat(n>=2 ? opdstd(2) : NULL, ptr))) {
+                    eprintf("illegal field name '%s'", ptr);
+                    return shareval(val_blank);
+                }
+                return val;
+            }
+
         case FN_is_connected:
             return newint(is_connected(n>0 ? opdstd(1) : ""));
 
@@ -1480,6 +1496,7 @@ static Value *function_switch(const ExprFunc *func, int n, const char *parent)
             char name[] = "opt_?";
             int offset;
             current_command = parent;
+            if (!need_argv()) return shareval(val_zero);
             if (!tf_argv) {
                 eprintf("getopts may only be called from a command.");
                 return shareval(val_zero);
@@ -1546,6 +1563,13 @@ static Value *function_switch(const ExprFunc *func, int n, const char *parent)
         case FN_nread:
             return newint(read_depth);
 
+        case FN_compile_info:
+            if ((i = compiled_info(opdstd(1))) < 0) {
+                eprintf("illegal field name '%s'", opdstd(1));
+                return shareval(val_blank);
+            }
+            return newint(i);
+
         case FN_nactive:
             return newint(nactive(n ? opdstd(1) : NULL));
 
@@ -1633,14 +1657,20 @@ static Value *do_function(int n /* number of operands (including func id) */)
         cmd = valptr(val);
         if (cmd->macro)
             macro = (cmd->macro);
-    } else if (!(macro = find_hashed_macro(val->name, val->u.hash))) {
+    } else if (val->u.id.ref.macro && val->u.id.gen == macro_generation) {
+        /* same macro as last time this call was executed */
+        macro = val->u.id.ref.macro;
+    } else if (!(macro = find_hashed_macro(val->name, val->u.id.hash))) {
         eprintf("%s: no such function", val->name);
         return NULL;
+    } else {
+        val->u.id.ref.macro = macro;
+        val->u.id.gen = macro_generation;
     }
 
     if (macro) {
         Value *saved_user_result;
-        int saved_argtop, saved_argc;
+        int saved_argtop, saved_argc, saved_argv_pending;
         Arg *saved_argv;
 
         /* pass parameters by value, not by [pseudo]reference */
@@ -1655,11 +1685,13 @@ static Value *do_function(int n /* number of operands (including func id) */)
         saved_argtop = argtop;
         saved_argc = tf_argc;
         saved_argv = tf_argv;
+        saved_argv_pending = argv_pending;
         saved_user_result = user_result;
 
         argtop = stacktop;
         tf_argc = n;
         tf_argv = NULL;
+        argv_pending = -1;
         user_result = NULL; /* prevent macro from freeing it */
 
         func_result = do_macro(macro, NULL, 0, USED_NAME, 0) ?
@@ -1668,6 +1700,7 @@ static Value *do_function(int n /* number of operands (including func id) */)
         argtop = saved_argtop;
         tf_argc = saved_argc;
         tf_argv = saved_argv;
+        argv_pending = saved_argv_pending;
         user_result = saved_user_result;
 
     } else /* if (cmd) */ {
@@ -1701,6 +1734,17 @@ static int assignment_expr(Program *prog)
     return 1;
 }
 
+/* Add a conditional jump with a place holder address, and set jump_point to
+ * its index for comefrom(), or to -1 if the optimizer removed it (i.e., the
+ * condition was a constant that never jumps).
+ */
+#define code_add_jump(prog, op, jump_point) \
+    do { \
+        int oldlen_ = (prog)->len; \
+        code_add((prog), (op), -1);     /* place holder */ \
+        (jump_point) = ((prog)->len >= oldlen_) ? (prog)->len - 1 : -1; \
+    } while (0)
+
 static int conditional_expr(Program *prog)
 {
     int jump_point;
@@ -1710,12 +1754,10 @@ static int conditional_expr(Program *prog)
         while (is_space(*++ip));
         if (*ip == ':') {
             code_add(prog, OP_DUP, 1);  /* reuse condition val as true val */
-            code_add(prog, OP_JNZ, -1); /* place holder */
-            jump_point = prog->len - 1;
+            code_add_jump(prog, OP_JNZ, jump_point);
             code_add(prog, OP_POP, 1);  /* discard dup'd value */
         } else {
-            code_add(prog, OP_JZ, -1);  /* place holder */
-            jump_point = prog->len - 1;
+            code_add_jump(prog, OP_JZ, jump_point);
             if (!comma_expr(prog)) return 0;
             if (*ip != ':') {
                 parse_error(prog, "expression", "':' after '?...'");
@@ -1740,8 +1782,7 @@ static int or_expr(Program *prog)
     while (*ip == '|') {
         ip++;
         code_add(prog, OP_DUP, 1);
-        code_add(prog, OP_JNZ, -1);     /* place holder */
-        jump_point = prog->len - 1;
+        code_add_jump(prog, OP_JNZ, jump_point);
         code_add(prog, OP_POP, 1);      /* discard dup'd value */
         if (!and_expr(prog)) return 0;
         comefrom(prog, jump_point, prog->len);
@@ -1757,8 +1798,7 @@ static int and_expr(Program *prog)
     while (*ip == '&') {
         ip++;
         code_add(prog, OP_DUP, 1);
-        code_add(prog, OP_JZ, -1);      /* place holder */
-        jump_point = prog->len - 1;
+        code_add_jump(prog, OP_JZ, jump_point);
         code_add(prog, OP_POP, 1);      /* discard dup'd value */
         if (!relational_expr(prog)) return 0;
         comefrom(prog, jump_point, prog->len);
@@ -7,30 +7,33 @@
  ************************************************************************/
 
 /* sorted by name */
+/* Pure: no side effects, and the result depends only on the arguments, so a
+ * call with constant arguments can be evaluated at compile time. */
 /*	 Name		Pure	Arguments */
-/*			(!used)	Min Max	  */
+/*				Min Max	  */
 
 funccode(abs,		1,	1,  1),
 funccode(acos,		1,	1,  1),
 funccode(addworld,	0,	2,  9),
-funccode(ascii,		1,	1,  1),
+funccode(ascii,		0,	1,  1),
 funccode(asin,		1,	1,  1),
 funccode(atan,		1,	1,  1),
 #if ENABLE_ATCP
 funccode(atcp,		0,	1,  2),
 #endif
 #if LUA_ENABLED
-funccode(calllua,	1,	1,  (unsigned) -1),
+funccode(calllua,	0,	1,  (unsigned) -1),
 #endif
-funccode(char,		1,	1,  1),
+funccode(char,		0,	1,  1),
 funccode(columns,	0,	0,  0),
+funccode(compile_info,	0,	1,  1),
 funccode(cos,		1,	1,  1),
 funccode(cputime,	0,	0,  0),
-funccode(decode_ansi,	1,	1,  1),
-funccode(decode_attr,	1,	1,  3),
+funccode(decode_ansi,	0,	1,  1), /* !pure: result has attrs */
+funccode(decode_attr,	0,	1,  3), /* !pure: result has attrs */
 funccode(echo,		0,	1,  4),
-funccode(encode_ansi,	1,	1,  1),
-funccode(encode_attr,	1,	1,  1),
+funccode(encode_ansi,	0,	1,  1), /* !pure: reads attrs */
+funccode(encode_attr,	0,	1,  1), /* !pure: reads attrs */
 funccode(eval,		0,	1,  2),
 funccode(exp,		1,	1,  1),
 funccode(fake_recv,	0,	1,  3),
@@ -40,14 +43,14 @@ funccode(ftime,		0,	0,  2),
 funccode(fwrite,	0,	2,  2),
 funccode(gethostname,	0,	0,  0),
 funccode(getopts,	0,	1,  2),
-funccode(getpid,	1,	0,  0),
+funccode(getpid,	0,	0,  0), /* !pure: differs per process */
 #if ENABLE_GMCP
 funccode(gmcp,		0,	1,  2),
 #endif
 funccode(idle,		0,	0,  1),
 funccode(is_connected,	0,	0,  1),
 funccode(is_open,	0,	0,  1),
-funccode(isatty,	1,	0,  0),
+funccode(isatty,	0,	0,  0),
 funccode(kbdel,		0,	1,  1),
 funccode(kbgoto,	0,	1,  1),
 funccode(kbhead,	0,	0,  0),
@@ -58,7 +61,7 @@ funccode(kbtail,	0,	0,  0),
 funccode(kbwordleft,	0,	0,  1),
 funccode(kbwordright,	0,	0,  1),
 funccode(keycode,	0,	1,  1),
-funccode(lines,		1,	0,  0),
+funccode(lines,		0,	0,  0),
 funccode(ln,		1,	1,  1),
 funccode(log10,		1,	1,  1),
 funccode(mktime,	0,	1,  7), /* !pure: uses TZ */
@@ -86,9 +89,10 @@ funccode(replace,	1,	3,  3),
 funccode(send,		0,	1,  3),
 funccode(sidle,		0,	0,  1),
 funccode(sin,		1,	1,  1),
+funccode(sockstat,	0,	1,  2),
 funccode(sqrt,		1,	1,  1),
-funccode(status_fields,	1,	0,  1),
-funccode(status_width,	1,	1,  1),
+funccode(status_fields,	0,	0,  1),
+funccode(status_width,	0,	1,  1),
 funccode(strcat,	1,	1,  (unsigned)-1),
 funccode(strchr,	1,	2,  3),
 funccode(strcmp,	1,	2,  2),
@@ -99,7 +103,7 @@ funccode(strncmp,	1,	3,  3),
 funccode(strrchr,	1,	2,  3),
 funccode(strrep,	1,	2,  2),
 funccode(strstr,	1,	2,  3),
-funccode(substitute,	1,	1,  3),
+funccode(substitute,	0,	1,  3),
 funccode(substr,	1,	2,  3),
 funccode(systype,	1,	0,  0),
 funccode(tan,		1,	1,  1),
@@ -114,6 +118,6 @@ funccode(time,		0,	0,  0),
 funccode(tolower,	1,	1,  2),
 funccode(toupper,	1,	1,  2),
 funccode(trunc,		1,	1,  1),
-funccode(whatis,	1,	1,  1),
-funccode(winlines,	1,	0,  0),
+funccode(whatis,	0,	1,  1), /* !pure: inspects operand */
+funccode(winlines,	0,	0,  0),
 funccode(world_info,	0,	0,  2)
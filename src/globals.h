@@ -53,7 +53,16 @@ typedef union ValueUnion {
     struct RegInfo *ri;		/* compiled regexp (STR|REGEX) */
     struct Program *prog;	/* compiled expression (STR|EXPR) */
     void *p;			/* other pointer type (FILE, FUNC, CMD) */
-    unsigned int hash;		/* hash value (ID) */
+    struct {			/* identifier (ID) */
+	unsigned int hash;	/* hash value */
+	unsigned int gen;	/* generation when ref was found:  even
+				 * var_generation for ref.var, odd
+				 * macro_generation for ref.macro */
+	union {
+	    struct Var *var;	/* nearest variable with this name */
+	    struct Macro *macro; /* macro called as a function */
+	} ref;
+    } id;
     attr_t attr;		/* attributes (STR|ATTR) */
     struct Value *next;		/* valpool pointer */
 } ValueUnion;
@@ -110,7 +119,6 @@ struct Var {
     int flags;
     conString *enumvec;		/* list of valid enum values */
     Toggler *func;		/* called when value changes */
-    struct ListEntry *node;	/* backpointer to node in list */
     short statuses;		/* # of status fields watching this var */
     short statusfmts;		/* # of status fields using this var as fmt */
     short statusattrs;		/* # of status fields using this var as attr */
@@ -175,15 +183,18 @@ enum Vars {
 #endif
 #define cleardone	getintvar(VAR_cleardone)
 #define clearfull	getintvar(VAR_clearfull)
+#define compile_cache	getintvar(VAR_compile_cache)
 #define clock_flag	getintvar(VAR_clock)
 #define defcompile	getintvar(VAR_defcompile)
 #define emulation 	getintvar(VAR_emulation)
+#define encode_cache	getintvar(VAR_encode_cache)
 #define error_attr	getattrvar(VAR_error_attr)
 #define expand_tabs 	getintvar(VAR_expand_tabs)
 #define expnonvis 	getintvar(VAR_expnonvis)
 #define gag		getintvar(VAR_gag)
 #define async_name	getintvar(VAR_async_name)
 #define async_conn	getintvar(VAR_async_conn)
+#define connect_delay	gettimevar(VAR_connect_delay)
 #define gpri		getintvar(VAR_gpri)
 #define hilite		getintvar(VAR_hilite)
 #define hiliteattr	getattrvar(VAR_hiliteattr)
@@ -211,6 +222,7 @@ enum Vars {
 #define lpquote		getintvar(VAR_lpquote)
 #define maildelay	gettimevar(VAR_maildelay)
 #define matching	getintvar(VAR_matching)
+#define max_connecting	getintvar(VAR_max_connecting)
 #define max_hook	getintvar(VAR_max_hook)
 #define max_instr	getintvar(VAR_max_instr)
 #define max_kbnum	getintvar(VAR_max_kbnum)
@@ -222,6 +234,7 @@ enum Vars {
 #define meta_esc	getintvar(VAR_meta_esc)
 #define more		getintvar(VAR_more)
 #define mprefix		getstrvar(VAR_mprefix)
+#define name_cache	gettimevar(VAR_name_cache)
 #define oldslash	getintvar(VAR_oldslash)
 #define optimize_user	getintvar(VAR_optimize)
 #define pedantic	getintvar(VAR_pedantic)
@@ -237,6 +250,8 @@ enum Vars {
 #define refreshtime	getintvar(VAR_refreshtime)
 #define scroll		getintvar(VAR_scroll)
 #define secho		getintvar(VAR_secho)
+#define send_backlog	getintvar(VAR_send_backlog)
+#define send_batch	getintvar(VAR_send_batch)
 #define shpause		getintvar(VAR_shpause)
 #define sigfigs		getintvar(VAR_sigfigs)
 #define snarf		getintvar(VAR_snarf)
@@ -247,6 +262,7 @@ enum Vars {
 #define ssl_continue	getintvar(VAR_ssl_continue)
 #define ssl_depth	getintvar(VAR_ssl_depth)
 #define ssl_verbose	getintvar(VAR_ssl_verbose)
+#define ssl_session_file getstdvar(VAR_ssl_session_file)
 #define ssl_insecure getintvar(VAR_ssl_insecure)
 #define status_attr	getattrvar(VAR_stat_attr)
 #define status_fields	getstdvar(VAR_stat_fields)
@@ -148,9 +148,14 @@ static void save_to_log(History *hist, const conString *str)
        }
      }
 
-    if (ansi_log)
-        SStringcat(log_buffer, (const conString *) encode_ansi(str, 0));
-    else
+    if (ansi_log) {
+        /* the input line may be edited in place later, so don't memoize */
+        conString *encoded = (hist == input) ? CS(encode_ansi(str, 0)) :
+            encode_line((conString *)str, TRUE);
+        encoded->links++;
+        SStringcat(log_buffer, encoded);
+        conStringfree(encoded);
+    } else
         SStringcat(log_buffer, str);
         
     if (wraplog) {
@@ -14,6 +14,7 @@ gencode(ACTIVITY,	HT_ALERT | HT_XSOCK),
 #if ENABLE_ATCP
 gencode(ATCP,		0),
 #endif
+gencode(BACKLOG,	HT_WORLD | HT_XSOCK),
 gencode(BAMF,		HT_WORLD | HT_XSOCK),
 gencode(BGTEXT,		0),
 gencode(BGTRIG,		HT_ALERT | HT_XSOCK),
@@ -40,7 +40,6 @@ typedef struct {
 struct Macro {
     const char *name;
     struct ListEntry *numnode;		/* node in maclist */
-    struct ListEntry *hashnode;		/* node in macro_table hash bucket */
     struct ListEntry *trignode;		/* node in one of the triglists */
     struct Macro *tnext;		/* temp list ptr for collision/death */
     conString *body, *expr;
@@ -57,7 +56,7 @@ struct Macro {
     subattr_t *subattr;
     short prob, shots, invis;
     short flags;
-    signed char fallthru, quiet;
+    signed char fallthru, quiet, coalesce;
     struct BuiltinCmd *builtin;		/* builtin cmd with same name, if any */
     int used[USED_N];			/* number of calls by each method */
 };
@@ -66,6 +65,14 @@ typedef struct {
     Pattern name, body, bind, keyname, expr;
 } AuxPat;
 
+typedef struct DeferredHook {	/* firings of a coalescing (-C) hook */
+    Macro *macro;
+    int hooknum;
+    String *text;		/* hook arguments */
+    struct Sock *sock;		/* xsock when the hook fired */
+    int count;			/* number of identical firings */
+} DeferredHook;
+
 typedef struct {
     int shortflag;
     int usedflag;
@@ -86,13 +93,14 @@ static int     list_defs(TFILE *file, Macro *spec, int mflag, ListOpts *opts);
 static void    apply_attrs_of_match(Macro *macro, String *text, int hooknum,
 		String *line);
 static int     run_match(Macro *macro, String *text, int hooknum);
+static int     defer_hook(Macro *macro, String *text, int hooknum);
 static const String *hook_name(const hookvec_t *hook) PURE;
 static conString *print_def(TFILE *file, String *buffer, Macro *p);
 static int     rpricmp(const Macro *m1, const Macro *m2);
 static void    nuke_macro(Macro *macro);
 
 
-#define HASH_SIZE 997	/* prime number */
+#define HASH_SIZE 1024	/* initial size; grows as needed */
 
 #define MACRO_TEMP	0x01
 #define MACRO_DEAD	0x02
@@ -106,8 +114,14 @@ static List triglist[1];		/* list of macros by trigger */
 static List hooklist[NUM_HOOKS];	/* lists of macros by hook */
 static Macro *dead_macros;		/* head of list of dead macros */
 static HashTable macro_table[1];	/* macros hashed by name */
+static HashTable hook_hash[1];		/* hook_table hashed by name */
 static World NoWorld, AnyWorld;		/* explicit "no" and "any" */
+static List deferred_hooks[1];		/* coalescing hooks waiting to run */
+static int running_deferred = 0;	/* in run_deferred_hooks()? */
 static int mnum = 0;			/* macro ID number */
+unsigned int macro_generation = 1;	/* changes when any macro is added or
+					 * killed; see do_function().  Always
+					 * odd; see ValueUnion.id. */
 
 typedef enum {
     HT_TEXT = 0x00,	/* normal text in fg world */
@@ -136,11 +150,15 @@ static const hookrec_t hook_table[] = {
 void init_macros(void)
 {
     int i;
-    init_hashtable(macro_table, HASH_SIZE, cstrstructcmp);
+    init_hashtable(macro_table, "macros", HASH_SIZE, cstrstructcmp);
     init_list(maclist);
     init_list(triglist);
-    for (i = 0; i < (int)NUM_HOOKS; i++)
+    init_list(deferred_hooks);
+    init_hashtable(hook_hash, "hooks", NUM_HOOKS, cstrstructcmp);
+    for (i = 0; i < (int)NUM_HOOKS; i++) {
 	init_list(&hooklist[i]);
+	hash_insert((void *)&hook_table[i], hook_hash);
+    }
 }
 
 /***************************************
@@ -150,8 +168,7 @@ void init_macros(void)
 int hookname2int(const char *name)
 {
     const hookrec_t *hookrec;
-    hookrec = bsearch((void*)(name), (void *)hook_table,
-	NUM_HOOKS, sizeof(hookrec_t), cstrstructcmp);
+    hookrec = (const hookrec_t *)hash_find(name, hook_hash);
     if (hookrec)
 	return hookrec - hook_table;
     if (cstrcmp(name, "BACKGROUND") == 0) /* backward compatability */
@@ -216,12 +233,13 @@ static Macro *macro_spec(String *args, int offset, int *xmflag, ListOpts *listop
     spec->body = spec->expr = NULL;
     spec->prog = spec->exprprog = NULL;
     spec->name = spec->bind = spec->keyname = NULL;
-    spec->numnode = spec->trignode = spec->hashnode = NULL;
+    spec->numnode = spec->trignode = NULL;
     init_pattern_str(&spec->trig, NULL);
     init_pattern_str(&spec->hargs, NULL);
     init_pattern_str(&spec->wtype, NULL);
     spec->world = NULL;
     spec->pri = spec->prob = spec->shots = spec->fallthru = spec->quiet = -1;
+    spec->coalesce = -1;
     VEC_ZERO(&spec->hook);
     spec->invis = 0;
     spec->attr = 0;
@@ -234,7 +252,7 @@ static Macro *macro_spec(String *args, int offset, int *xmflag, ListOpts *listop
     spec->used[USED_NAME] = spec->used[USED_TRIG] =
 	spec->used[USED_HOOK] = spec->used[USED_KEY] = 0;
 
-    startopt(CS(args), "usSp#c#b:B:E:t:w:h:A:a:f:P:T:FiIn#1m:q" +
+    startopt(CS(args), "usSp#c#b:B:E:t:w:h:A:a:f:P:T:FiIn#1m:qC" +
 	(listopts ? 0 : 3));
     while (!error && (opt = nextopt(&ptr, &uval, NULL, &offset))) {
         switch (opt) {
@@ -383,6 +401,9 @@ static Macro *macro_spec(String *args, int offset, int *xmflag, ListOpts *listop
         case 'q':
             spec->quiet = TRUE;
             break;
+        case 'C':
+            spec->coalesce = TRUE;
+            break;
         case '1':
             spec->shots = 1;
             break;
@@ -421,9 +442,7 @@ static Macro *macro_spec(String *args, int offset, int *xmflag, ListOpts *listop
     }
     while (nameend > name && is_space(nameend[-1])) nameend--;
     if (nameend > name) {
-	char *buf = strncpy(XMALLOC(nameend - name + 1), name, nameend - name);
-	buf[nameend - name] = '\0';
-	spec->name = buf;
+	spec->name = intern(name, nameend - name);
     }
 
     return spec;
@@ -583,6 +602,7 @@ int macro_equal(Macro *m1, Macro *m2)
     if (m1->shots != m2->shots) return 0;
     if (m1->fallthru != m2->fallthru) return 0;
     if (m1->quiet != m2->quiet) return 0;
+    if (m1->coalesce != m2->coalesce) return 0;
     if (m1->prob != m2->prob) return 0;
     if (m1->pri != m2->pri) return 0;
     if (m1->attr != m2->attr) return 0;
@@ -666,10 +686,10 @@ int add_new_macro(const char *trig, const char *bind, const hookvec_t *hook,
         eprintf("add_new_macro: not enough memory");
         return 0;
     }
-    new->numnode = new->trignode = new->hashnode = NULL;
+    new->numnode = new->trignode = NULL;
     new->flags = MACRO_TEMP;
     new->prog = new->exprprog = NULL;
-    new->name = STRDUP("");
+    new->name = intern("", 0);
     (new->body = CS(Stringnew(body, -1, 0)))->links++;
     new->expr = NULL;
     new->bind = STRDUP(bind);
@@ -693,6 +713,7 @@ int add_new_macro(const char *trig, const char *bind, const hookvec_t *hook,
     new->invis = invis;
     new->fallthru = FALSE;
     new->quiet = FALSE;
+    new->coalesce = FALSE;
     new->builtin = NULL;
     new->used[USED_NAME] = new->used[USED_TRIG] =
 	new->used[USED_HOOK] = new->used[USED_KEY] = 0;
@@ -754,9 +775,10 @@ static int add_numbered_macro(Macro *macro, unsigned int hash, int num,
     }
     macro->num = num ? num : ++mnum;
     macro->numnode = inlist((void *)macro, maclist, numnode);
+    macro_generation += 2;
 
     if (*macro->name) {
-        macro->hashnode = hashed_insert((void *)macro, hash, macro_table);
+        hashed_insert((void *)macro, hash, macro_table);
 	if (macro->builtin) { /* macro->builtin was set in complete_macro() */
 	    macro->builtin->macro = macro;
 	}
@@ -889,7 +911,8 @@ static int complete_macro(Macro *spec, unsigned int hash, int num,
     if (spec->invis) spec->invis = 1;
     if (spec->fallthru < 0) spec->fallthru = 0;
     if (spec->quiet < 0) spec->quiet = 0;
-    if (!spec->name) spec->name = STRNDUP("", 0);
+    if (spec->coalesce < 0) spec->coalesce = 0;
+    if (!spec->name) spec->name = intern("", 0);
     if (!spec->body) (spec->body = blankline)->links++;
     /*if (!spec->expr) (spec->expr = blankline)->links++;*/
 
@@ -997,8 +1020,8 @@ struct Value *handle_edit_command(String *args, int offset)
     numnode = macro->numnode->prev;
     kill_macro(macro);
 
-    FREE(spec->name);
-    spec->name = STRDUP(macro->name);
+    unintern(spec->name);
+    spec->name = intern_dup(macro->name);
 
     if (!spec->body && macro->body) (spec->body = macro->body)->links++;
     if (!spec->expr && macro->expr) (spec->expr = macro->expr)->links++;
@@ -1021,6 +1044,7 @@ struct Value *handle_edit_command(String *args, int offset)
     if (spec->shots < 0) spec->shots = macro->shots;
     if (spec->fallthru < 0) spec->fallthru = macro->fallthru;
     if (spec->quiet < 0) spec->quiet = macro->quiet;
+    if (spec->coalesce < 0) spec->coalesce = macro->coalesce;
     if (spec->attr == 0) spec->attr = macro->attr;
     if (spec->nsubattr == 0 && macro->nsubattr > 0) {
 	spec->nsubattr = macro->nsubattr;
@@ -1067,10 +1091,11 @@ void kill_macro(Macro *macro)
 
     if (macro->flags & MACRO_DEAD) return;
     macro->flags |= MACRO_DEAD;
+    macro_generation += 2;
     macro->tnext = dead_macros;
     dead_macros = macro;
     unlist(macro->numnode, maclist);
-    if (*macro->name) hash_remove(macro->hashnode, macro_table);
+    if (*macro->name) hash_remove(macro, macro_table);
     if (*macro->bind) unbind_key(macro->bind);
 }
 
@@ -1118,7 +1143,7 @@ static void nuke_macro(Macro *m)
     free_pattern(&m->trig);
     free_pattern(&m->hargs);
     free_pattern(&m->wtype);
-    if (m->name) FREE(m->name);
+    if (m->name) unintern(m->name);
     FREE(m);
 }
 
@@ -1148,7 +1173,7 @@ struct Value *handle_purge_command(String *args, int offset)
         return shareval(val_zero);
     if (spec->name && *spec->name == '#') {
         spec->num = atoi(spec->name + 1);
-        FREE(spec->name);
+        unintern(spec->name);
         spec->name = NULL;
     }
     if (!(init_aux_patterns(spec, mflag, &aux)))
@@ -1308,6 +1333,7 @@ static conString *print_def(TFILE *file, String *buffer, Macro *p)
 	Sappendf(buffer, "-b'%q' ", '\'', ascii_to_print(p->bind)->data);
 
     if (p->quiet) Stringcat(buffer, "-q ");
+    if (p->coalesce) Stringcat(buffer, "-C ");
     if (*p->name == '-') Stringcat(buffer, "- ");
     if (*p->name) Sappendf(buffer, "%s ", p->name);
     if (p->body && p->body->len) Sappendf(buffer, "= %S", p->body);
@@ -1334,7 +1360,7 @@ static int list_defs(TFILE *file, Macro *spec, int mflag, ListOpts *listopts)
     if (!(init_aux_patterns(spec, mflag, &aux))) goto error;
     if (spec->name && *spec->name == '#') {
         spec->num = atoi(spec->name + 1);
-        FREE(spec->name);
+        unintern(spec->name);
         spec->name = NULL;
     }
 
@@ -1717,7 +1743,10 @@ int find_and_run_matches(String *text, int hooknum, String **linep,
 		    if (linep && *linep)
 			apply_attrs_of_match(macro, text, hooknum, *linep);
 		    if (hooknum>=0) {
-			enqueue(runq, macro);
+			if (macro->coalesce && !running_deferred)
+			    ran += defer_hook(macro, text, hooknum);
+			else
+			    enqueue(runq, macro);
 		    } else {
 			ran += run_match(macro, text, hooknum);
 			if (linep && hooknum<0) {
@@ -1771,7 +1800,10 @@ int find_and_run_matches(String *text, int hooknum, String **linep,
 	    if (linep && *linep)
 		apply_attrs_of_match(macro, text, hooknum, *linep);
 	    if (hooknum>=0) {
-		enqueue(runq, macro);
+		if (macro->coalesce && !running_deferred)
+		    ran += defer_hook(macro, text, hooknum);
+		else
+		    enqueue(runq, macro);
 	    } else {
 		ran += run_match(macro, text, hooknum);
 	    }
@@ -1965,11 +1997,92 @@ static int run_match(
     return ran;
 }
 
+/* Instead of running a coalescing hook now, remember it for
+ * run_deferred_hooks().  Firings with the same macro, arguments and xsock as
+ * one already waiting just increment its count.
+ */
+static int defer_hook(Macro *macro, String *text, int hooknum)
+{
+    ListEntry *node;
+    DeferredHook *dh;
+
+    for (node = deferred_hooks->head; node; node = node->next) {
+	dh = (DeferredHook *)node->datum;
+	if (dh->macro == macro && dh->hooknum == hooknum &&
+	    dh->sock == xsock && dh->text->len == text->len &&
+	    memcmp(dh->text->data, text->data, text->len) == 0)
+	{
+	    dh->count++;
+	    return !macro->quiet;
+	}
+    }
+
+    dh = XMALLOC(sizeof(DeferredHook));
+    dh->macro = macro;
+    dh->hooknum = hooknum;
+    (dh->text = Stringdup(CS(text)))->links++;
+    dh->sock = xsock;
+    dh->count = 1;
+    inlist((void *)dh, deferred_hooks, deferred_hooks->tail);
+    return !macro->quiet;
+}
+
+/* Run the coalescing hooks deferred since the last call, in the order they
+ * first fired.  Each runs once, with the local variable %hook_count set to the
+ * number of firings it stands for.  Called once per main_loop() pass, before
+ * dead socks and macros are freed.  Hooks fired while these run are not
+ * deferred again.
+ */
+void run_deferred_hooks(void)
+{
+    DeferredHook *dh;
+    struct Sock *saved_xsock = xsock;
+    List scope[1];
+
+    if (running_deferred) return;
+    running_deferred++;
+    while (deferred_hooks->head) {
+	dh = (DeferredHook *)unlist(deferred_hooks->head, deferred_hooks);
+	if (!(dh->macro->flags & MACRO_DEAD)) {
+	    xsock = dh->sock;
+	    pushvarscope(scope);
+	    setlocalintvar("hook_count", dh->count);
+	    recur_count++;
+	    run_match(dh->macro, dh->text, dh->hooknum);
+	    recur_count--;
+	    popvarscope();
+	}
+	Stringfree(dh->text);
+	FREE(dh);
+    }
+    xsock = saved_xsock;
+    running_deferred--;
+}
+
+/* sock is about to be freed; deferred firings from it will run with no
+ * current socket. */
+void forget_deferred_sock(struct Sock *sock)
+{
+    ListEntry *node;
+
+    for (node = deferred_hooks->head; node; node = node->next)
+	if (((DeferredHook *)node->datum)->sock == sock)
+	    ((DeferredHook *)node->datum)->sock = NULL;
+}
+
 #if USE_DMALLOC
 void free_macros(void)
 {
+    DeferredHook *dh;
+
+    while (deferred_hooks->head) {
+	dh = (DeferredHook *)unlist(deferred_hooks->head, deferred_hooks);
+	Stringfree(dh->text);
+	FREE(dh);
+    }
     while (maclist->head) nuke_macro((Macro *)maclist->head->datum);
     free_hash(macro_table);
+    free_hash(hook_hash);
 }
 #endif
 
@@ -11,7 +11,10 @@
 
 enum { USED_NAME, USED_TRIG, USED_HOOK, USED_KEY, USED_N }; /* for Macro.used */
 
+struct Sock;
+
 extern int invis_flag;
+extern unsigned int macro_generation;
 
 extern void   init_macros(void);
 extern int    macro_equal(Macro *m1, Macro *m2);
@@ -34,6 +37,8 @@ extern int    do_macro(Macro *macro, String *args, int offset,
 extern const char *macro_body(const char *name);
 extern int    find_and_run_matches(String *text, int hooknum, String **linep,
 		struct World *world, int globalflag, int exec_list_long);
+extern void   run_deferred_hooks(void);
+extern void   forget_deferred_sock(struct Sock *sock);
 
 #define macro_hash(name) \
     (!name ? 0 : (*name == '#') ? atoi(name + 1) : hash_string(name))
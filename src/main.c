@@ -234,6 +234,7 @@ int main(int argc, char *argv[])
 #if USE_DMALLOC
     free_macros();
     free_worlds();
+    free_attr();
     free_histories();
     free_output();
     free_vars();
@@ -44,6 +44,7 @@ defopcode(LT       ,'<',  EXPR, INT,  0)     /*  <   */
 defopcode(GT       ,'>',  EXPR, INT,  0)     /*  >   */
 
 /* positional parameter substitution operators.  Flag: 0 push, 1 append */
+/* Must be numbered 'A' through 'G' (see op_is_posparm()). */
 defopcode(PPARM    ,'A', SUB,  INT,  0)     /* {3} positional param */
 defopcode(APARM    ,'A', SUB,  INT,  APP)
 defopcode(PXPARM   ,'B', SUB,  INT,  0)     /* {-3} complementary pos param */
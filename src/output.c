@@ -138,6 +138,10 @@ typedef struct statusfield {
     int row;
     attr_t attrs;	/* attibutes from status_fields */
     attr_t vattrs;	/* attibutes from status_attr_{int,var}_<name> */
+    int dirty;		/* needs to be reformatted and redisplayed */
+    struct Sock *sock;	/* xsock when field was marked dirty */
+    long nformat;	/* number of times formatted */
+    struct timeval cost;/* total time spent formatting */
 } StatusField;
 
 static Var bogusvar;   /* placeholder for StatusField->var */
@@ -166,6 +170,8 @@ static void  attributes_off(attr_t attrs);
 static void  attributes_on(attr_t attrs);
 static void  color_on(const char *prefix, long color);
 static void  hwrite(conString *line, int start, int len, int indent);
+static void  put_status_cells(int row, int start, int width);
+static void  invalidate_status_shadow(int top, int bottom);
 static int   check_more(Screen *screen);
 static int   next_physline(Screen *screen);
 static void  output_novisual(PhysLine *pl);
@@ -213,6 +219,12 @@ String status_line[][1] = {	    /* formatted status lines, without alert */
     STATIC_BUFFER_INIT, STATIC_BUFFER_INIT, STATIC_BUFFER_INIT,
     STATIC_BUFFER_INIT, STATIC_BUFFER_INIT, STATIC_BUFFER_INIT };
 #define max_status_height   (sizeof(status_line)/sizeof(String))
+/* Status lines as displayed, for diffing in put_status_cells().  Only the
+ * status area is shadowed; the output and input windows are redrawn by
+ * their own scrolling and insert/delete-line logic. */
+static String status_shadow[][1] = {
+    STATIC_BUFFER_INIT, STATIC_BUFFER_INIT, STATIC_BUFFER_INIT,
+    STATIC_BUFFER_INIT, STATIC_BUFFER_INIT, STATIC_BUFFER_INIT };
 static StatusField *variable_width_field[max_status_height];
 
 STATIC_BUFFER(outbuf);              /* output buffer */
@@ -238,6 +250,7 @@ static int status_right[max_status_height]; /* size of status line right part */
 static int alert_row = 0;	    /* row of status area where alert appears */
 static int alert_pos = 0;	    /* column where alert appears */
 static int alert_len = 0;	    /* length of current alert message */
+static int status_dirty = 0;	    /* does any status field need update? */
 
 STATIC_STRING(moreprompt, "--More--", F_BOLD | F_REVERSE);  /* pager prompt */
 
@@ -407,6 +420,7 @@ static void init_line_numbers(void)
     stat_bot = out_bot + status_height;
     in_top = stat_bot + 1;
     in_bot = stat_bot + isize;
+    invalidate_status_shadow(1, lines);
 }
 
 /* Initialize output data. */
@@ -436,6 +450,8 @@ void init_output(void)
 	init_list(statusfield_list[i]);
 	Stringninit(status_line[i], columns);
 	check_charattrs(status_line[i], columns, 0, __FILE__, __LINE__);
+	Stringninit(status_shadow[i], columns);
+	check_charattrs(status_shadow[i], columns, 0, __FILE__, __LINE__);
     }
 
     redraw();
@@ -646,6 +662,7 @@ static void xy(int x, int y)
 
 static void clr(void)
 {
+    invalidate_status_shadow(1, lines);
     if (clear_screen)
         tp(clear_screen);
     else {
@@ -1809,8 +1826,10 @@ static int format_statusfield(StatusField *field)
     Value *fmtval, *val = NULL;
     Program *prog;
     int width, x, i;
+    struct timeval start, end;
 
     output_disabled++;
+    gettime(&start);
     Stringtrunc(scratch, 0);
     if (field->internal >= 0 || field->var) {
         fmtval = getvarval(field->fmtvar);
@@ -1892,39 +1911,147 @@ static int format_statusfield(StatusField *field)
     if (field->var && !field->var->status)   /* var was unset */
         field->var = NULL;
 #endif
+    gettime(&end);
+    tvsub(&end, &end, &start);
+    tvadd(&field->cost, &field->cost, &end);
+    field->nformat++;
     output_disabled--;
     return width;
 }
 
+/* Mark status cells on screen lines top..bottom as unknown, so the next
+ * put_status_cells() rewrites them.  '\0' never appears in a status line.
+ */
+static void invalidate_status_shadow(int top, int bottom)
+{
+    int row;
+
+    if (!stat_top) return;  /* before init_line_numbers() */
+    for (row = 0; row < max_status_height; row++) {
+	if (stat_top + row < top || stat_top + row > bottom) continue;
+	if (status_shadow[row]->len)
+	    memset(status_shadow[row]->data, '\0', status_shadow[row]->len);
+    }
+}
+
+#define status_cell_changed(row, i) \
+    (status_shadow[row]->data[i] != status_line[row]->data[i] || \
+    status_shadow[row]->charattrs[i] != status_line[row]->charattrs[i])
+
+/* Cursor addressing costs several bytes, so an unchanged gap shorter than
+ * this is rewritten instead of skipped. */
+#define STATUS_GAP 6
+
+/* Return the number of screen columns occupied by the first len bytes of
+ * str, which is what xy() needs when str holds multibyte or wide characters.
+ */
+static int status_columns(const char *str, int len)
+{
+    int col = 0;
+#if WIDECHAR
+    UText *ut = NULL;
+    UErrorCode icuerr = U_ZERO_ERROR;
+    UChar32 c;
+
+    ut = utext_openUTF8(ut, str, len, &icuerr);
+    if (!U_SUCCESS(icuerr))
+        return len;
+    while ((c = UTEXT_NEXT32(ut)) != U_SENTINEL) {
+        if (c == '\t') {
+            col += tabsize - col % tabsize;
+            continue;
+        }
+        switch (u_getIntPropertyValue(c, UCHAR_EAST_ASIAN_WIDTH)) {
+            case U_EA_FULLWIDTH:
+            case U_EA_WIDE:
+                col += 2;
+                break;
+            default:
+                col++;
+        }
+    }
+    utext_close(ut);
+#else
+    int i;
+
+    for (i = 0; i < len; i++) {
+        if (str[i] == '\t')
+            col += tabsize - col % tabsize;
+        else
+            col++;
+    }
+#endif
+    return col;
+}
+
+/* Write the cells of status row in [start, start+width) that differ from
+ * what is already on the terminal, and remember what was written.
+ */
+static void put_status_cells(int row, int start, int width)
+{
+    String *line = status_line[row], *shadow = status_shadow[row];
+    int end = start + width, i, last, runstart;
+
+    if (shadow->len != line->len ||
+	memchr(line->data + start, '\t', width))
+    {
+	/* tab expansion depends on the starting column; don't split it */
+	xy(status_columns(line->data, start) + 1, stat_top + row);
+	hwrite(CS(line), start, width, 0);
+	return;
+    }
+
+    for (i = start; i < end; i++) {
+	if (!status_cell_changed(row, i)) continue;
+	runstart = i;
+	for (last = i++; i < end && i - last <= STATUS_GAP; i++) {
+	    if (status_cell_changed(row, i)) last = i;
+	}
+	i = last + 1;
+#if WIDECHAR
+	/* don't start or end in the middle of a multibyte character */
+	while (runstart > start && (line->data[runstart] & 0xC0) == 0x80)
+	    runstart--;
+	while (i < end && (line->data[i] & 0xC0) == 0x80)
+	    i++;
+#endif
+	xy(status_columns(line->data, runstart) + 1, stat_top + row);
+	hwrite(CS(line), runstart, i - runstart, 0);
+	memcpy(shadow->data + runstart, line->data + runstart, i - runstart);
+	memcpy(shadow->charattrs + runstart, line->charattrs + runstart,
+	    (i - runstart) * sizeof(cattr_t));
+    }
+}
+
 static void display_status_segment(int row, int start, int width)
 {
     if (!alert_len || row != alert_row ||
 	start + width <= alert_pos || start >= alert_pos + alert_len)
     {
 	/* no overlap with alert */
-	xy(start + 1, stat_top + row);
-	hwrite(CS(status_line[row]), start, width, 0);
+	put_status_cells(row, start, width);
     } else {
 	if (start < alert_pos) {
 	    /* segment starts left of alert */
-	    xy(start + 1, stat_top + row);
-	    hwrite(CS(status_line[row]), start, alert_pos - start, 0);
+	    put_status_cells(row, start, alert_pos - start);
 	}
 	if (start + width >= alert_pos) {
 	    /* segment ends right of alert */
-	    xy(alert_pos + alert_len + 1, stat_top + row);
-	    hwrite(CS(status_line[row]), alert_pos + alert_len,
-		start + width - (alert_pos + alert_len), 0);
+	    put_status_cells(row, alert_pos + alert_len,
+		start + width - (alert_pos + alert_len));
 	}
     }
 }
 
+/* Mark the fields that depend on var or internal as needing an update.
+ * The actual formatting and display is done by flush_status_fields(), so
+ * a field triggered many times between screen updates is formatted once.
+ */
 void update_status_field(Var *var, stat_id_t internal)
 {
     ListEntry *node;
     StatusField *field;
-    int row, column, width;
-    int count = 0;
+    int row;
 
     if (screen_mode < 1) return;
 
@@ -1947,27 +2074,118 @@ void update_status_field(Var *var, stat_id_t internal)
 		    continue;
 	    }
 	    if (internal >= 0 && field->internal != internal) continue;
+	    field->dirty = 1;
+	    field->sock = xsock;
+	    status_dirty = 1;
+	}
+    }
+}
+
+/* Format and display all status fields marked by update_status_field().
+ * Each field's expression is evaluated with the current socket that was
+ * in effect when it was marked.
+ */
+void flush_status_fields(void)
+{
+    static int depth = 0;
+    ListEntry *node;
+    StatusField *field;
+    struct Sock *old_xsock = xsock;
+    int row, column, width, full;
+    int count = 0;
+
+    if (depth) return;	/* don't recurse */
+    if (screen_mode < 1 || !status_dirty) return;
+    status_dirty = 0;
+    depth++;
+
+    for (row = 0; row < status_height; row++) {
+	full = 0;
+	for (node = statusfield_list[row]->head; node; node = node->next) {
+	    field = (StatusField*)node->datum;
 	    column = statusfield_column(field);
 	    if (column >= columns) /* doesn't fit, nor will any later fields */
-		break;
+		full = 1;
+	    if (!field->dirty) continue;
+	    field->dirty = 0;
+	    if (full) continue;
 	    count++;
+	    xsock = field->sock;
 	    width = format_statusfield(field);
 	    display_status_segment(row, column, width);
 	}
     }
+    xsock = old_xsock;
 
+    depth--;
     if (count) {
 	bufflush();
 	set_refresh_pending(REF_PHYSICAL);
     }
 }
 
+/* /status_profile [-r<N>] [-c]
+ * list the number of times each field in row N (default all) was formatted
+ * and the total time spent doing it; -c clears the counts.
+ */
+struct Value *handle_status_profile_command(String *args, int offset)
+{
+    int row = -1, opt, clear = FALSE;
+    ValueUnion uval;
+    const char *ptr;
+    ListEntry *node;
+    StatusField *f;
+    STATIC_BUFFER(buf);
+
+    startopt(CS(args), "r#c");
+    while ((opt = nextopt(&ptr, &uval, NULL, &offset))) {
+        switch (opt) {
+        case 'r':  row = uval.ival;     break;
+        case 'c':  clear = TRUE;        break;
+        default:   return shareval(val_zero);
+        }
+    }
+    if (row >= (int)max_status_height) {
+	eprintf("row must be < %d", (int)max_status_height);
+        return shareval(val_zero);
+    }
+
+    if (!clear)
+	oprintf("ROW COL     COUNT        SECONDS   USEC/EACH FIELD");
+    for (opt = 0; opt < max_status_height; opt++) {
+	if (row >= 0 && opt != row) continue;
+	for (node = statusfield_list[opt]->head; node; node = node->next) {
+	    f = (StatusField*)node->datum;
+	    if (clear) {
+		f->nformat = 0;
+		f->cost = tvzero;
+		continue;
+	    }
+	    if (f->internal < 0 && !f->var) continue;  /* constant */
+	    Stringtrunc(buf, 0);
+	    if (f->internal >= 0)
+		SStringcat(Stringadd(buf, '@'), &enum_status[f->internal]);
+	    else
+		Stringcat(buf, f->var->val.name);
+	    oprintf("%3d %3d %9ld %7ld.%06ld %11ld %S", opt,
+		statusfield_column(f), f->nformat,
+		(long)f->cost.tv_sec, (long)f->cost.tv_usec,
+		!f->nformat ? 0L : (f->cost.tv_sec * 1000000L +
+		    f->cost.tv_usec) / f->nformat,
+		buf);
+	}
+    }
+
+    return shareval(val_one);
+}
+
 void format_status_line(void)
 {
     ListEntry *node;
     StatusField *field;
     int row, column, width;
 
+    status_dirty = 0;
     for (row = 0; row < status_height; row++) {
 	column = 0;
 	width = 0;
@@ -1978,6 +2196,8 @@ void format_status_line(void)
 		break;
 	    width = format_statusfield(field);
 	}
+	for (node = statusfield_list[row]->head; node; node = node->next)
+	    ((StatusField*)node->datum)->dirty = 0;
 
 	for (column += width; column < columns; column++) {
 	    status_line[row]->data[column] = true_status_pad;
@@ -2060,6 +2280,8 @@ void alert(conString *msg)
 	tvadd(&alert_timeout, &alert_timeout, &alert_time);
 
 	xy(alert_pos + 1, stat_top + alert_row);
+	if (status_shadow[alert_row]->len >= alert_pos + alert_len)
+	    memset(status_shadow[alert_row]->data + alert_pos, '\0', alert_len);
 	orig_attrs = msg->attrs;
 	msg->attrs = adj_attr(msg->attrs, alert_attr);
 	hwrite(msg, 0, alert_len, 0);
@@ -2074,8 +2296,7 @@ void alert(conString *msg)
 void clear_alert(void)
 {
     if (!alert_len) return;
-    xy(alert_pos + 1, stat_top + alert_row);
-    hwrite(CS(status_line[alert_row]), alert_pos, alert_len, 0);
+    put_status_cells(alert_row, alert_pos, alert_len);
     bufflush();
     set_refresh_pending(REF_PHYSICAL);
     alert_timeout = tvzero;
@@ -2093,7 +2314,12 @@ int ch_visual(Var *var)
 	if (status_line[row]->len < columns)
 	    Stringnadd(status_line[row], '?', columns - status_line[row]->len);
 	Stringtrunc(status_line[row], columns);
+	if (status_shadow[row]->len < columns)
+	    Stringnadd(status_shadow[row], '\0',
+		columns - status_shadow[row]->len);
+	Stringtrunc(status_shadow[row], columns);
     }
+    invalidate_status_shadow(1, lines);
 
     if (screen_mode < 0) {                /* e.g., called by init_variables() */
         return 1;
@@ -2194,6 +2420,7 @@ void minimal_fix_screen(void)
 static void clear_lines(int start, int end)
 {
     if (start > end) return;
+    invalidate_status_shadow(start, end);
     xy(1, start);
     if (end >= lines && clear_to_eos) {
         tp(clear_to_eos);  /* cx,cy were set by xy() */
@@ -2659,6 +2886,7 @@ int igoto(int place)
 void do_refresh(void)
 {
     if (visual && need_more_refresh) update_status_field(NULL, STAT_MORE);
+    flush_status_fields();
     if (need_refresh >= REF_LOGICAL) logical_refresh();
     else if (need_refresh >= REF_PHYSICAL) physical_refresh();
 }
@@ -2849,12 +3077,16 @@ static void color_on(const char *prefix, long color)
     }
 }
 
+/* Write len bytes of line to the terminal, starting at start.  Runs of
+ * identical charattrs are found as the line is drawn; this saves work in
+ * drawing only, as line->charattrs still has one entry per byte.
+ */
 static void hwrite(conString *line, int start, int len, int indent)
 {
     attr_t attrs = line->attrs & F_HWRITE;
     attr_t current = 0;
-    attr_t new;
-    int i, ctrl;
+    attr_t runattrs, new;
+    int i, n, ctrl, end, runend;
     int col = 0;
     char c;
 #if WIDECHAR
@@ -2881,39 +3113,69 @@ static void hwrite(conString *line, int start, int len, int indent)
     if (!line->charattrs && hilite && attrs)
         attributes_on(current = attrs);
 
-    for (i = start; i < start + len; ++i) {
-        new = line->charattrs ? adj_attr(attrs, line->charattrs[i]) : attrs;
-        c = unmapchar(localize(line->data[i]));
-        ctrl = (emulation > EMUL_RAW && is_cntrl(c) && c != '\t');
-        if (ctrl)
-            new |= F_BOLD | F_REVERSE;
-        if (new != current) {
-            if (current) attributes_off(current);
-            current = new;
-            if (current) attributes_on(current);
-        }
-        if (c == '\t') {
-            bufputnc(' ', tabsize - col % tabsize);
-            col += tabsize - col % tabsize;
-        } else {
-#if WIDECHAR
-	    ret = mbrtowc(NULL, (char *)line->data+i, start + len - i, &is);
-	    if (ret >= (size_t) -2) {
-		/* Invalid character. Punt. */
-		bufputc(ctrl ? CTRL(c) : c);
-	    } else {
-		int j = 1;
-		bufputc(c);
-		while (j++ < ret) {
-		  c = line->data[++i];
-		  bufputc(c);
+    end = start + len;
+    for (i = start; i < end; ) {
+	/* Find the run of characters sharing the same attributes, so
+	 * adj_attr() is called once per run instead of once per char. */
+	if (line->charattrs) {
+	    for (runend = i + 1; runend < end &&
+		line->charattrs[runend] == line->charattrs[i]; runend++);
+	    runattrs = adj_attr(attrs, line->charattrs[i]);
+	} else {
+	    runend = end;
+	    runattrs = attrs;
+	}
+
+	while (i < runend) {
+	    /* Printable ASCII needs no mapping; copy it in one piece. */
+	    for (n = i; n < runend && line->data[n] >= ' ' &&
+		line->data[n] < '\177'; n++);
+	    if (n > i) {
+		if (runattrs != current) {
+		    if (current) attributes_off(current);
+		    current = runattrs;
+		    if (current) attributes_on(current);
 		}
+		Stringfncat(outbuf, line->data + i, n - i);
+		col += n - i;
+		i = n;
+		continue;
+	    }
+
+	    new = runattrs;
+	    c = unmapchar(localize(line->data[i]));
+	    ctrl = (emulation > EMUL_RAW && is_cntrl(c) && c != '\t');
+	    if (ctrl)
+		new |= F_BOLD | F_REVERSE;
+	    if (new != current) {
+		if (current) attributes_off(current);
+		current = new;
+		if (current) attributes_on(current);
 	    }
+	    if (c == '\t') {
+		bufputnc(' ', tabsize - col % tabsize);
+		col += tabsize - col % tabsize;
+	    } else {
+#if WIDECHAR
+		ret = mbrtowc(NULL, (char *)line->data+i, end - i, &is);
+		if (ret >= (size_t) -2) {
+		    /* Invalid character. Punt. */
+		    bufputc(ctrl ? CTRL(c) : c);
+		} else {
+		    int j = 1;
+		    bufputc(c);
+		    while (j++ < ret) {
+		      c = line->data[++i];
+		      bufputc(c);
+		    }
+		}
 #else
-            bufputc(ctrl ? CTRL(c) : c);
+		bufputc(ctrl ? CTRL(c) : c);
 #endif
-            col++;
-        }
+		col++;
+	    }
+	    i++;
+	}
     }
     if (current) attributes_off(current);
 }
@@ -3364,6 +3626,8 @@ void oflush(void)
         }
         lastsize = moresize(screen);
     }
+
+    flush_status_fields();
 }
 
 static void output_novisual(PhysLine *pl)
@@ -49,6 +49,7 @@ extern int  ch_status_int(Var *var);
 extern int  ch_status_fields(Var *var);
 extern int  ch_status_height(Var *var);
 extern void update_status_field(Var *var, stat_id_t internal);
+extern void flush_status_fields(void);
 extern void format_status_line(void);
 extern int  display_status_line(void);
 extern int  update_status_line(Var *var);
@@ -51,6 +51,8 @@ typedef enum {
 #define op_has_sideeffect(op)		(((op) & OPF_MASK) == OPF_SIDE)
 #define opnum(op)			((op) & OPNUM_MASK)
 #define opnum_eq(op1, op2)		(opnum(op1) == opnum(op2))
+#define op_is_posparm(op) \
+    (op_type_is(op, SUB) && opnum(op) >= 'A' && opnum(op) <= 'G')
 
 typedef enum {
 #define defopcode(name, num, optype, argtype, flag) \
@@ -84,6 +86,8 @@ struct Program {
     int size;		/* size of code array */
     const char *mark;	/* pointer into source code, for mecho */
     int optimize;	/* opimization level */
+    int emitted;	/* number of instructions before optimization */
+    int links;		/* number of pointers to this structure */
 };
 
 typedef struct Arg {
@@ -110,8 +114,10 @@ extern int         pushval(Value *val);
 extern void        freeval_fl(Value *val, const char *file, int line);
 extern Value      *expr_value(const char *expression);
 extern Value      *expr_value_safe(Program *prog);
+extern int         pure_function(const Value *func);
 extern void        code_add(Program *prog, opcode_t op, ...);
 extern int         reduce(opcode_t op, int n);
+extern int         split_argv(void);
 extern const char *oplabel(opcode_t op);
 
 extern struct Value *newptr_fl(void *ptr, const char *file, int line);
@@ -140,10 +146,14 @@ extern struct Value *newptr_fl(void *ptr, const char *file, int line);
 
 #define ip  (prog->sip)	/* XXX */
 
+/* make sure tf_argv and tf_argc are valid */
+#define need_argv()	(argv_pending < 0 || split_argv())
+
 extern Value *stack[];			/* expression stack */
 extern int stacktop;			/* first free position on stack */
 extern Arg *tf_argv;			/* shifted command argument vector */
 extern int tf_argc;			/* shifted command/function arg count */
+extern int argv_pending;		/* offset of argstring not yet split */
 extern int argtop;			/* top of function argument stack */
 extern const conString *argstring;	/* command argument text */
 extern keyword_id_t block;		/* type of current expansion block */
@@ -66,6 +66,9 @@ typedef struct Proc {
     conString *cmd;		/* command or file name */
     Stringp buffer;		/* buffer for prefix+cmd+suffix */
     struct Program *prog;	/* compiled repeat command */
+    int heapidx;		/* index in procheap, or -1 */
+    struct Proc *duenext;	/* next in runall()'s list of due procs */
+    struct Proc *deadnext;	/* next in list of procs awaiting nukeproc() */
     struct Proc *next, *prev;
 } Proc;
 
@@ -77,12 +80,24 @@ static int  runproc(Proc *proc);
 static int  do_repeat(Proc *proc);
 static int  do_quote(Proc *proc);
 static void strip_escapes(char *src);
+static void schedule_proc(Proc *proc);
+static void unschedule_proc(Proc *proc);
 
 struct timeval proctime = { 0, 0 };	/* when next process should be run */
 
 static int runall_depth = 0;
 static Proc *proclist = NULL;		/* head of process list */
 static Proc *proctail = NULL;		/* tail of process list */
+static Proc *dead_procs = NULL;		/* procs awaiting nukeproc() */
+static int shell_procs = 0;		/* number of live P_QSHELL procs */
+static int prompt_procs = 0;		/* number of live PTIME_PROMPT procs */
+
+/* Live timed procs, in a binary min-heap ordered by timer (and pid, to keep
+ * creation order among procs due at the same time).  proctime is always the
+ * timer of procheap[0], so finding the next deadline needs no scan.
+ */
+static Proc **procheap = NULL;
+static int heapsize = 0, heapmax = 0;
 
 
 static void format_approx_interval(char *buf, struct timeval *tvp)
@@ -230,6 +245,7 @@ static struct Value *newproc(int type, int (*func)(Proc *proc), int count,
     proc->pid = ++hipid;
     proc->input = input;
     proc->world = world;
+    proc->heapidx = -1;
     Stringzero(proc->buffer);
 
     *(proctail ? &proctail->next : &proclist) = proc;
@@ -238,6 +254,8 @@ static struct Value *newproc(int type, int (*func)(Proc *proc), int count,
     proctail = proc;
 
     proc->state = PROC_RUNNING;
+    if (type == P_QSHELL) shell_procs++;
+    if (ptime->tv_sec == PTIME_PROMPT) prompt_procs++;
     do_hook(H_PROCESS, NULL, "%d", proc->pid);
     if (ptime->tv_sec == PTIME_SYNC) {  /* synch */
         oflush();  /* flush now, process might take a while */
@@ -249,13 +267,9 @@ static struct Value *newproc(int type, int (*func)(Proc *proc), int count,
 	}
         return killproc(proc, 1);  /* no nuke! */
     }
-    if (lpquote || proc->ptime.tv_sec == PTIME_PROMPT) {
+    if (lpquote || proc->ptime.tv_sec == PTIME_PROMPT)
 	runproc(proc);	/* XXX should do this asynchronously, in main loop */
-    } else if (tvcmp(&proctime, &tvzero) == 0 ||
-	tvcmp(&proc->timer, &proctime) < 0)
-    {
-        proctime = proc->timer;
-    }
+    schedule_proc(proc);
     return newint(proc->pid);
 }
 
@@ -263,6 +277,13 @@ static struct Value *killproc(Proc *proc, int needresult)
 {
     int result = 1;
 
+    if (proc->state != PROC_DEAD) {
+	proc->deadnext = dead_procs;
+	dead_procs = proc;
+	if (proc->type == P_QSHELL) shell_procs--;
+	if (proc->ptime.tv_sec == PTIME_PROMPT) prompt_procs--;
+	unschedule_proc(proc);
+    }
     proc->state = PROC_DEAD;
     do_hook(H_KILL, NULL, "%d", proc->pid);
 
@@ -292,12 +313,11 @@ static void nukeproc(Proc *proc)
 
 void nuke_dead_procs(void)
 {
-    Proc *proc, *next;
+    Proc *proc;
 
-    for (proc = proclist; proc; proc = next) {
-        next = proc->next;
-        if (proc->state == PROC_DEAD)
-            nukeproc(proc);
+    while ((proc = dead_procs)) {
+	dead_procs = proc->deadnext;
+	nukeproc(proc);
     }
 }
 
@@ -313,6 +333,11 @@ void kill_procs(void)
         nukeproc(proclist);
     }
 
+    if (procheap) FREE(procheap);
+    procheap = NULL;
+    heapsize = heapmax = 0;
+    dead_procs = NULL;
+    shell_procs = prompt_procs = 0;
     proctime = tvzero;
 }
 
@@ -350,56 +375,134 @@ int ch_lpquote(Var *var)
     return 1;
 }
 
+static int proc_before(Proc *a, Proc *b)
+{
+    int cmp = tvcmp(&a->timer, &b->timer);
+    return cmp < 0 || (cmp == 0 && a->pid < b->pid);
+}
+
+/* Move proc to its correct place in procheap, starting from proc->heapidx. */
+static void heap_sift(Proc *proc)
+{
+    int i = proc->heapidx, child;
+
+    while (i > 0 && proc_before(proc, procheap[(i - 1) / 2])) {
+	procheap[i] = procheap[(i - 1) / 2];
+	procheap[i]->heapidx = i;
+	i = (i - 1) / 2;
+    }
+    while ((child = 2 * i + 1) < heapsize) {
+	if (child + 1 < heapsize &&
+	    proc_before(procheap[child + 1], procheap[child]))
+		child++;
+	if (!proc_before(procheap[child], proc)) break;
+	procheap[i] = procheap[child];
+	procheap[i]->heapidx = i;
+	i = child;
+    }
+    procheap[i] = proc;
+    proc->heapidx = i;
+}
+
+static void set_proctime(void)
+{
+    proctime = (heapsize && !lpquote) ? procheap[0]->timer : tvzero;
+}
+
+/* Insert a live timed proc into procheap, or reposition it after its timer
+ * has changed.
+ */
+static void schedule_proc(Proc *proc)
+{
+    if (proc->state == PROC_DEAD || proc->ptime.tv_sec < PTIME_VAR)
+	return;
+    if (proc->heapidx < 0) {
+	if (heapsize == heapmax) {
+	    heapmax = heapmax ? 2 * heapmax : 16;
+	    procheap = XREALLOC(procheap, heapmax * sizeof(Proc*));
+	}
+	proc->heapidx = heapsize++;
+    }
+    heap_sift(proc);
+    set_proctime();
+}
+
+static void unschedule_proc(Proc *proc)
+{
+    Proc *last;
+
+    if (proc->heapidx < 0) return;
+    last = procheap[--heapsize];
+    if (last != proc) {
+	last->heapidx = proc->heapidx;
+	heap_sift(last);
+    }
+    proc->heapidx = -1;
+    set_proctime();
+}
+
+static void runsched(Proc *proc)
+{
+    if (!runproc(proc))
+	killproc(proc, 0);  /* no nuke! */
+    else
+	schedule_proc(proc);
+}
+
 /* Run all processes that should be run.
  * If prompted, run promptable procs;
  * if !prompted, run timed procs;
  * and, always run procs that were already marked runnable pending a shell
  * line if that shell line has become available.
- * If !prompted, set proctime to the time of the next earliest process.
+ * Only procs that may need a shell line or a prompt are found by walking
+ * proclist; due timed procs are taken from the top of procheap.
  */
 void runall(int prompted, World *world)
 {
-    Proc *proc;
+    Proc *proc, *due = NULL, **duetail = &due;
     struct timeval now;
-    int resched;	/* consider this process in proctime calculation? */
     int promptable;	/* proc should be run iff prompted */
 
     gettime(&now);
     runall_depth++;
-    if (!prompted)
-	proctime = tvzero;
-    for (proc = proclist; proc; proc = proc->next) {
-        if (proc->state == PROC_DEAD) continue;
-	promptable = (lpquote || proc->ptime.tv_sec == PTIME_PROMPT);
-        if (proc->type == P_QSHELL) {
-            if (is_active(fileno(proc->input->u.fp))) {
-                if (!(resched = runproc(proc)))
-                    killproc(proc, 0);  /* no nuke! */
-	    } else if (promptable != prompted) {
-		continue;
-	    } else if (prompted && proc->world && world && proc->world != world)
+    if (shell_procs || (prompted && (lpquote || prompt_procs))) {
+	for (proc = proclist; proc; proc = proc->next) {
+	    if (proc->state == PROC_DEAD) continue;
+	    promptable = (lpquote || proc->ptime.tv_sec == PTIME_PROMPT);
+	    if (proc->type == P_QSHELL && is_active(fileno(proc->input->u.fp)))
 	    {
-		/* prompt wasn't from the right world */
+		runsched(proc);
+	    } else if (!prompted || !promptable) {
 		continue;
-            } else if (promptable || tvcmp(&proc->timer, &now) <= 0) {
-                resched = FALSE;
-                readers_set(fileno(proc->input->u.fp));
-            } else {
-		resched = TRUE;
+	    } else if (proc->type != P_QSHELL) {
+		runsched(proc);
+	    } else if (!proc->world || !world || proc->world == world) {
+		/* wait for the shell line, outside of procheap */
+		unschedule_proc(proc);
+		readers_set(fileno(proc->input->u.fp));
 	    }
-	} else if (promptable != prompted) {
-	    continue;
-	} else if (promptable || tvcmp(&proc->timer, &now) <= 0) {
-            if (!(resched = runproc(proc)))
-                killproc(proc, 0);  /* no nuke! */
-        } else resched = TRUE;
-
-        if (resched && !prompted &&
-           (tvcmp(&proctime,&tvzero) == 0 || tvcmp(&proc->timer,&proctime) < 0))
-        {
-            proctime = proc->timer;
-        }
+	}
+    }
+
+    if (!prompted && !lpquote) {
+	/* Take all due procs off the heap first, so a proc that reschedules
+	 * itself for "now" can't run more than once in this pass. */
+	while (heapsize && tvcmp(&procheap[0]->timer, &now) <= 0) {
+	    proc = procheap[0];
+	    unschedule_proc(proc);
+	    proc->duenext = NULL;
+	    *duetail = proc;
+	    duetail = &proc->duenext;
+	}
+	for (proc = due; proc; proc = proc->duenext) {
+	    if (proc->state == PROC_DEAD) continue;
+	    if (proc->type == P_QSHELL)
+		readers_set(fileno(proc->input->u.fp));
+	    else
+		runsched(proc);
+	}
     }
+    set_proctime();
     runall_depth--;
 }
 
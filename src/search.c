@@ -141,26 +141,51 @@ ListEntry *inlist_fl(void *datum, List *list, ListEntry *where,
 /* hash table */
 /**************/
 
-void init_hashtable(HashTable *table, int size, Cmp *cmp)
+HashTable *hashtable_list = NULL;	/* all tables, for /hashstat */
+
+/* hash_string() values differ mostly in their low bits, which would cluster
+ * badly with linear probing, so the home slot is taken from the high bits
+ * of a multiplicative (Fibonacci) hash.
+ */
+#define hash_home(table, hash) \
+    (((hash) * 0x9E3779B9U & 0xFFFFFFFFU) >> (table)->shift)
+
+void init_hashtable(HashTable *table, const char *name, int size, Cmp *cmp)
 {
-    table->size = size;
+    int n;
+
+    table->shift = 32 - 4;
+    for (n = 16; n < size; n <<= 1) table->shift--;
+    table->size = n;
+    table->count = 0;
     table->cmp = cmp;
-    table->bucket = (List **)XMALLOC(sizeof(List *) * size);
-    while (size)
-        table->bucket[--size] = NULL;
+    table->slot = (HashSlot *)XMALLOC(sizeof(HashSlot) * n);
+    while (n)
+        table->slot[--n].datum = NULL;
+    table->name = name;
+    table->finds = table->probes = 0;
+    table->grows = 0;
+    table->next = hashtable_list;
+    hashtable_list = table;
 }
 
 /* find entry by name */
 void *hashed_find(const char *name, unsigned int hash, HashTable *table)
 {
-    List *bucket;
-    ListEntry *node;
-
-    bucket = table->bucket[hash % table->size];
-    if (bucket) {
-        for (node = bucket->head; node; node = node->next)
-            if ((*table->cmp)((void *)name, node->datum) == 0)
-                return node->datum;
+    unsigned int mask = table->size - 1;
+    unsigned int i;
+    HashSlot *slot;
+
+    table->finds++;
+    for (i = hash_home(table, hash); (slot = &table->slot[i])->datum;
+        i = (i+1) & mask)
+    {
+        table->probes++;
+        if (slot->hash == hash && (*(const char **)slot->datum == name ||
+            (*table->cmp)((void *)name, slot->datum) == 0))
+        {
+            return slot->datum;
+        }
     }
     return NULL;
 }
@@ -174,20 +199,133 @@ unsigned int hash_string(const char *str)
     return h;
 }
 
-ListEntry *hashed_insert(void *datum, unsigned int hash, HashTable *table)
+static void hash_place(HashTable *table, void *datum, unsigned int hash)
+{
+    unsigned int mask = table->size - 1;
+    unsigned int i;
+
+    for (i = hash_home(table, hash); table->slot[i].datum; i = (i+1) & mask);
+    table->slot[i].hash = hash;
+    table->slot[i].datum = datum;
+}
+
+void hashed_insert(void *datum, unsigned int hash, HashTable *table)
+{
+    if ((table->count + 1) * 2 > table->size) {
+        /* Grow.  Hashes are cached, so keys don't need to be rehashed. */
+        HashSlot *old = table->slot;
+        int i, oldsize = table->size;
+        table->size *= 2;
+        table->shift--;
+        table->slot = (HashSlot *)XMALLOC(sizeof(HashSlot) * table->size);
+        for (i = 0; i < table->size; i++)
+            table->slot[i].datum = NULL;
+        for (i = 0; i < oldsize; i++)
+            if (old[i].datum) hash_place(table, old[i].datum, old[i].hash);
+        FREE(old);
+        table->grows++;
+    }
+    hash_place(table, datum, hash);
+    table->count++;
+}
+
+void hash_remove(void *datum, HashTable *table)
 {
-    int indx = hash % table->size;
-    if (!table->bucket[indx]) {
-        table->bucket[indx] = (List *)XMALLOC(sizeof(List));
-        init_list(table->bucket[indx]);
+    unsigned int mask = table->size - 1;
+    unsigned int i, j, home;
+
+    for (i = hash_home(table, hash_string(*(char**)datum));
+        table->slot[i].datum != datum;
+        i = (i+1) & mask)
+    {
+        if (!table->slot[i].datum) return; /* not in table */
     }
-    return inlist(datum, table->bucket[indx], NULL);
+
+    /* Shift back any following entries that would no longer be reachable
+     * across the gap, so lookups never need tombstones. */
+    for (j = (i+1) & mask; table->slot[j].datum; j = (j+1) & mask) {
+        home = hash_home(table, table->slot[j].hash);
+        /* move j to i unless home is cyclically in (i, j] */
+        if (i <= j ? (home <= i || home > j) : (home <= i && home > j)) {
+            table->slot[i] = table->slot[j];
+            i = j;
+        }
+    }
+    table->slot[i].datum = NULL;
+    table->count--;
 }
 
 
-void hash_remove(ListEntry *node, HashTable *tab)
+/* length of the longest probe sequence needed to find any datum */
+int hash_maxprobe(HashTable *table)
 {
-    unlist(node, tab->bucket[hash_string(*(char**)node->datum) % tab->size]);
+    unsigned int mask = table->size - 1;
+    unsigned int i, len, maxlen = 0;
+
+    for (i = 0; i < table->size; i++) {
+        if (!table->slot[i].datum) continue;
+        len = ((i - hash_home(table, table->slot[i].hash)) & mask) + 1;
+        if (len > maxlen) maxlen = len;
+    }
+    return maxlen;
+}
+
+
+/********************/
+/* interned strings */
+/********************/
+
+static HashTable intern_table[1];
+
+/* Return the interned copy of the first <len> chars of <str> (all of <str>
+ * if <len> < 0), creating it if needed.  The caller must unintern() it.
+ */
+const char *intern(const char *str, int len)
+{
+    unsigned int hash, mask, i;
+    const char *p;
+    char *data;
+    Interned *in;
+
+    if (len < 0) len = strlen(str);
+    for (hash = 0, p = str; p < str + len; p++)
+        hash = (hash << 5) + hash + lcase(*p);	/* same as hash_string() */
+
+    if (!intern_table->slot)
+        init_hashtable(intern_table, "names", 1024, strstructcmp);
+    intern_table->finds++;
+    mask = intern_table->size - 1;
+    for (i = hash_home(intern_table, hash); intern_table->slot[i].datum;
+        i = (i+1) & mask)
+    {
+        intern_table->probes++;
+        in = (Interned *)intern_table->slot[i].datum;
+        if (intern_table->slot[i].hash == hash &&
+            strncmp(in->str, str, len) == 0 && !in->str[len])
+        {
+            in->links++;
+            return in->str;
+        }
+    }
+
+    in = (Interned *)XMALLOC(sizeof(Interned) + len + 1);
+    data = (char *)(in + 1);
+    memcpy(data, str, len);
+    data[len] = '\0';
+    in->str = data;
+    in->hash = hash;
+    in->links = 1;
+    hashed_insert(in, hash, intern_table);
+    return in->str;
+}
+
+void unintern(const char *str)
+{
+    Interned *in = interned(str);
+
+    if (--in->links > 0) return;
+    hash_remove(in, intern_table);
+    FREE(in);
 }
 
 
@@ -326,10 +464,10 @@ void free_search(void)
 
 void free_hash(HashTable *table)
 {
-    int i;
-    for (i = 0; i < table->size; i++) {
-        if (table->bucket[i]) FREE(table->bucket[i]);
-    }
-    FREE(table->bucket);
+    HashTable **tp;
+
+    for (tp = &hashtable_list; *tp != table; tp = &(*tp)->next);
+    *tp = table->next;
+    FREE(table->slot);
 }
 #endif
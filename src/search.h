@@ -85,12 +85,32 @@ typedef struct List {
     ListEntry *head, *tail;
 } List;
 
+typedef struct HashSlot {
+    unsigned int hash;		/* cached hash of datum's key */
+    void *datum;		/* NULL if slot is empty */
+} HashSlot;
+
+/* Open-addressed (linear probing) table that doubles when it is half full. */
 typedef struct HashTable {
-    int size;			/* number of buckets */
+    int size;			/* number of slots (a power of 2) */
+    int shift;			/* 32 - log2(size) */
+    int count;			/* number of data */
     Cmp *cmp;
-    List **bucket;
+    HashSlot *slot;
+    const char *name;		/* for /hashstat */
+    struct HashTable *next;	/* list of all tables, for /hashstat */
+    long finds, probes;		/* hashed_find() calls, slots examined */
+    int grows;			/* number of times table was resized */
 } HashTable;
 
+/* An interned string is stored once, right after this header, with its
+ * hash_string() value, so equal interned strings have equal pointers. */
+typedef struct Interned {
+    const char *str;		/* the string (must be first member!) */
+    unsigned int hash;		/* hash_string(str) */
+    int links;			/* reference count */
+} Interned;
+
 typedef struct CQueue {		/* circular queue of data */
     void **data;		/* array of pointers to data */
     void (*free)(void*, const char*, int);	/* function to free a datum */
@@ -110,6 +130,10 @@ typedef struct CQueue {		/* circular queue of data */
 #define inlist(datum, list, where) \
 			inlist_fl((datum), (list), (where), __FILE__, __LINE__)
 
+#define interned(str)		((Interned *)(str) - 1)
+#define interned_hash(str)	(interned(str)->hash)
+#define intern_dup(str)		(interned(str)->links++, (str))
+
 #define hash_find(name, table)	hashed_find(name, hash_string(name), table)
 #define hash_insert(datum, table) \
     hashed_insert(datum, hash_string(*(char**)datum), table)
@@ -120,12 +144,17 @@ extern ListEntry *inlist_fl(void *datum, List *list, ListEntry *where,
     const char *file, int line);
 extern ListEntry *sinsert(void *datum, List *list, Cmp *cmp);
 extern unsigned int hash_string(const char *str);
-extern void hash_remove(ListEntry *node, HashTable *table);
-extern ListEntry *hashed_insert(void *datum, unsigned int hash,
-    HashTable *table);
+extern HashTable *hashtable_list;
+
+extern void hash_remove(void *datum, HashTable *table);
+extern int hash_maxprobe(HashTable *table);
+extern void hashed_insert(void *datum, unsigned int hash, HashTable *table);
 extern void *hashed_find(const char *name, unsigned int hash,
     HashTable *table);
-extern void init_hashtable(HashTable *table, int size, Cmp *cmp);
+extern void init_hashtable(HashTable *table, const char *name, int size,
+    Cmp *cmp);
+extern const char *intern(const char *str, int len);
+extern void unintern(const char *str);
 
 extern int strstructcmp(const void *key, const void *datum);
 extern int cstrstructcmp(const void *key, const void *datum);
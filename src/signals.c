@@ -127,7 +127,7 @@ VEC_TYPEDEF(sig_set, (NSIG-1));
 const int feature_core = 1 - DISABLE_CORE;
 
 static const char *argv0 = NULL;
-static int have_pending_signals = 0;
+int have_pending_signals = 0;
 static sig_set pending_signals;
 static void (*parent_tstp_handler)(int sig);
 
@@ -16,6 +16,7 @@ extern int  shell_status(int result);
 extern int  shell(const char *cmd);
 extern int  suspend(void);
 extern int  interrupted(void);
+extern int  have_pending_signals;
 extern void crash(int internal, const char *fmt,
     const char *file, int line, long n) NORET;
 extern void close_all(void); /* defined in socket.c */
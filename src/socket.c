@@ -43,6 +43,7 @@
 
 #ifdef NETINET_IN_H
 # include NETINET_IN_H
+# include <netinet/tcp.h>	/* TCP_NODELAY */
 #else
 /* Last resort - we'll assume the "normal" stuff. */
 struct in_addr {
@@ -111,7 +112,11 @@ struct sockaddr_in {
 
 #ifdef PLATFORM_UNIX
 # ifndef __CYGWIN32__
-#  if HAVE_WAITPID
+#  if HAVE_PTHREAD_CREATE && !USE_MMALLOC
+#   define NONBLOCKING_GETHOST
+#   define THREADED_GETHOST	/* lookup in a thread instead of a child */
+#   include <pthread.h>
+#  elif HAVE_WAITPID
 #   define NONBLOCKING_GETHOST
 #  endif
 # endif
@@ -211,6 +216,20 @@ static const char *h_errlist[] = {
   static void waitforhostname(int fd, const char *name, const char *port);
   static int nonblocking_gethost(const char *name, const char *port,
       struct addrinfo **addrs, pid_t *pidp, const char **what);
+  static void unpack_addrinfo(struct addrinfo *ai);
+  static struct addrinfo *namecache_find(const char *host, const char *port);
+  static void namecache_store(const char *host, const char *port,
+      const char *data, int size);
+
+  /* Results of nonblocking name lookups, kept for %name_cache so that
+   * connecting to the same host again needs no new lookup. */
+  typedef struct NameCache {
+      char *key;		/* "host port" (must be first member!) */
+      struct timeval expires;	/* when this entry is no longer valid */
+      int size;			/* size of packed addrinfo list */
+  } NameCache;		/* followed by packed addrinfo list, then key */
+
+  static HashTable namecache[1];
 #endif
 
 #ifndef INADDR_NONE
@@ -298,11 +317,36 @@ typedef enum {
 
 VEC_TYPEDEF(telnet_opts, 256);
 
+/* Parallel connection attempts (RFC 8305) need SO_ERROR to tell which of
+ * several pending sockets has connected. */
+#if TF_NONBLOCK && defined(SO_ERROR) && !SOCKS
+# define PARALLEL_CONNECT
+#endif
+#define MAX_ATTEMPTS	4	/* max # of older attempts left pending */
+
+#define LAT_BUCKETS 32
+
+typedef struct Latency {	/* distribution of a delay */
+    unsigned long n;		/* # of samples */
+    double total;		/* sum of samples, in seconds */
+    long max;			/* largest sample, in microseconds */
+    unsigned long hist[LAT_BUCKETS]; /* hist[i]: # of samples < 2**i usec */
+} Latency;
+
+typedef struct Attempt {	/* a pending connection attempt */
+    int fd;			/* connecting socket */
+    struct addrinfo *addr;	/* address being connected to */
+} Attempt;
+
 typedef struct Sock {		/* an open connection to a server */
     int fd;			/* socket to server, or pipe to name resolver */
     const char *host, *port;	/* server address, human readable */
     struct addrinfo *addrs;	/* possible server addresses */
     struct addrinfo *addr;	/* actual server address */
+    struct addrinfo *lastaddr;	/* last address in addrs we started on */
+    Attempt attempt[MAX_ATTEMPTS]; /* older attempts still pending */
+    int nattempts;		/* # of entries in attempt[] */
+    struct timeval next_attempt; /* when to start on the next address */
     const char *myhost;		/* explicit client address, human readable */
     struct addrinfo *myaddr;	/* explicit client address */
     telnet_opts tn_us;		/* our telnet options */
@@ -321,6 +365,14 @@ typedef struct Sock {		/* an open connection to a server */
     Stringp buffer;		/* above buffer processed into UTF-8 */
     Stringp subbuffer;		/* buffer for processing telnet commands */
     Queue queue;		/* queue of incoming lines */
+    Stringp outqueue;		/* outgoing bytes not yet accepted by socket */
+    int outqueue_off;		/* offset of first unsent byte in outqueue */
+    char backlogged;		/* BACKLOG hook was called for this backlog */
+    char write_wants_read;	/* SSL_write() can't go on until fd is readable */
+    char batched;		/* outqueue is held for the end of the pass */
+    unsigned long sendpass;	/* main_loop() pass of last unheld send */
+    char nowait;		/* don't wait briefly for lookup or connect */
+    char handshaking;		/* nonblocking SSL handshake is in progress */
     conString *prompt;		/* prompt from server */
     struct timeval prompt_timeout; /* when does unterm'd line become a prompt */
     int ttype;			/* index into enum_ttype[] */
@@ -328,11 +380,24 @@ typedef struct Sock {		/* an open connection to a server */
     attr_t prepromptattrs;	/* text attributes before implicit prompt */
     unsigned long alert_id;	/* id of last alert on this socket */
     struct timeval time[2];	/* time of last receive/send */
+    unsigned long bytes[2];	/* # of bytes received/sent */
+    unsigned long lines[2];	/* # of lines received/sent */
+    unsigned long calls[2];	/* # of successful reads/writes */
+    int qdepth, qmax;		/* # of lines in queue, and the most there were */
+    Latency display_lat;	/* delay from receiving lines to displaying them */
+    Latency key_lat;		/* delay from keypress to sending its output */
+    struct timeval keypending;	/* keypress whose output hasn't been sent */
     char fsastate;		/* parser finite state automaton state */
     char substate;		/* parser fsa state for telnet subnegotiation */
     pid_t pid;			/* OS pid of name resolution process */
 #if HAVE_MCCP
     z_stream *zstream;		/* state of compressed stream */
+    char *zbuffer;		/* inflated data, before telnet processing */
+    int zbufsize;		/* size of zbuffer */
+    unsigned long zin, zout;	/* compressed and inflated byte counts */
+    struct timeval ztime;	/* total time spent inflating */
+    z_stream *ozstream;		/* state of outgoing compressed stream */
+    unsigned long ozin, ozout;	/* bytes deflated, and what they became */
 #endif
 #if HAVE_SSL
     SSL *ssl;			/* SSL state */
@@ -355,6 +420,10 @@ static int   tfgetaddrinfo(const char *nodename, const char *port,
 static int   opensock(World *world, int flags);
 static int   openconn(Sock *new);
 static int   establish(Sock *new);
+static void  interleave_addrs(struct addrinfo *addrs);
+static void  run_attempts(void);
+static void  run_connect_queue(void);
+static int   poll_attempts(Sock *sock);
 #if 0
 static void  fg_live_sock(void);
 #endif
@@ -371,8 +440,22 @@ static int   inbound_decode_str(String *outut, String *input, UConverter *conv,
 static int   inbound_decode(String *output, const char *input, const char *iendptr, UConverter *conv, const char cflush);
 #endif
 static int   handle_socket_input(const char *simbuffer, int simlen, const char* encoding);
+#if HAVE_MCCP
+static z_stream *new_zstream(Sock *sock);
+static void  end_zstream(Sock *sock);
+#endif
 static void  handle_socket_input_queue_lines(Sock *sock);
+static int   sock_write(const char *str, unsigned int len);
+static int   flush_outqueue(void);
 static int   transmit(const char *s, unsigned int len);
+static int   transmit_raw(const char *s, unsigned int len, int hold);
+static int   hold_output(void);
+static void  flush_batches(void);
+static void  set_nodelay(int fd);
+#if HAVE_MCCP
+static void  start_mccp3(void);
+static void  end_mccp3(Sock *sock, int flush);
+#endif
 static void  telnet_send(String *cmd);
 static void  telnet_subnegotiation(void);
 static void  f_telnet_recv(int cmd, int opt);
@@ -403,11 +486,14 @@ static int   ssl_verify_callback(int preverify_ok, X509_STORE_CTX *ctx);
 #endif
 
 #define BUFFSIZE (4*1024)       /* how big are our byte-buffers? */
+#define ZBUFFMIN (4*BUFFSIZE)   /* initial inflate output window */
+#define ZBUFFMAX (64*BUFFSIZE)  /* largest inflate output window */
+#define BATCHMAX (16*BUFFSIZE)  /* held output is sent when it gets this big */
 #define SPAM (4*1024)		/* break loop if this many chars are received */
 
 static fd_set readers;		/* input file descriptors */
 static fd_set active;		/* active file descriptors */
-static fd_set writers;		/* pending connections */
+static fd_set writers;		/* pending connections and output */
 static fd_set connected;	/* completed connections */
 static unsigned int nfds;	/* max # of readers/writers */
 static Sock *hsock = NULL;	/* head of socket list */
@@ -416,6 +502,17 @@ static Sock *fsock = NULL;	/* foreground socket */
 static int dead_socks = 0;	/* Number of unnuked dead sockets */
 static int socks_with_lines = 0;/* Number of socks with queued received lines */
 static struct timeval prompt_timeout = {0,0};
+static struct timeval attempt_timeout = {0,0}; /* earliest next_attempt */
+static unsigned long loop_pass = 1;	/* # of current main_loop() pass */
+static int handling_keys = 0;	/* output is from keyboard_time's keypress */
+static int batched_socks = 0;	/* # of socks with held output */
+
+typedef struct PendingConn {	/* a world waiting its turn to /connect -m */
+    char *name;
+    int flags;
+} PendingConn;
+static List connect_queue[1];	/* list of PendingConn */
+
 static const char *telnet_label[0x100];
 STATIC_BUFFER(telbuf);
 
@@ -471,6 +568,8 @@ static const char *enum_charset[] = {
 /* 85 & 86 are not standard.  See http://www.randomly.org/projects/MCCP/ */
 #define TN_COMPRESS	((char)85)	/* MCCP v1 */
 #define TN_COMPRESS2	((char)86)	/* MCCP v2 */
+/* 87 is not standard.  See https://tintin.mudhalla.net/protocols/mccp/ */
+#define TN_COMPRESS3	((char)87)	/* MCCP v3 (client to server) */
 /* 200 is not standard. See http://www.ironrealms.com/rapture/manual/files/FeatATCP-txt.html */
 #define TN_ATCP		((char)200)	/* ATCP */
 /* 201 is not standard. See http://www.aardwolf.com/wiki/index.php/Clients/GMCP */
@@ -508,6 +607,7 @@ String *incoming_text = NULL;
 const int feature_IPv6 = ENABLE_INET6 - 0;
 const int feature_MCCPv1 = HAVE_MCCP - 0;
 const int feature_MCCPv2 = HAVE_MCCP - 0;
+const int feature_MCCPv3 = HAVE_MCCP - 0;
 const int feature_ssl = HAVE_SSL - 0;
 const int feature_SOCKS = SOCKS - 0;
 
@@ -607,7 +707,7 @@ typedef struct {
     int always_continue;
 } ssl_options_t;
 static ssl_options_t ssl_options;
-static int ssl_mydata_index;
+static int ssl_mydata_index = -1;
 
 static int ssl_verify_callback(int preverify_ok, X509_STORE_CTX *ctx)
 {
@@ -672,8 +772,155 @@ static int ssl_verify_callback(int preverify_ok, X509_STORE_CTX *ctx)
 	return preverify_ok;
 }
 
+/* TLS sessions from earlier connections, so reconnecting to the same
+ * server can resume with an abbreviated handshake. */
+typedef struct SslSession {
+    char *key;			/* "host port" (must be first member!) */
+    SSL_SESSION *session;
+} SslSession;			/* followed by key */
+
+static HashTable sslsessions[1];
+static int ssl_handshakes = 0;	/* # of completed handshakes */
+static int ssl_resumed = 0;	/* # of those that resumed a session */
+
+static const char *sslsession_key(World *world)
+{
+    STATIC_BUFFER(key);
+    Sprintf(key, "%s %s", world->host, world->port);
+    return key->data;
+}
+
+static void sslsession_store(const char *key, SSL_SESSION *session)
+{
+    SslSession *entry;
+    int keylen;
+
+    if ((entry = hash_find(key, sslsessions))) {
+	SSL_SESSION_free(entry->session);
+	entry->session = session;
+	return;
+    }
+    keylen = strlen(key) + 1;
+    entry = XMALLOC(sizeof(SslSession) + keylen);
+    entry->key = (char*)(entry + 1);
+    memcpy(entry->key, key, keylen);
+    entry->session = session;
+    hash_insert((void *)entry, sslsessions);
+}
+
+static void sslsessions_clear(void)
+{
+    int i;
+    SslSession *entry;
+
+    for (i = 0; i < sslsessions->size; i++) {
+	if (!(entry = sslsessions->slot[i].datum)) continue;
+	hash_remove(entry, sslsessions);
+	SSL_SESSION_free(entry->session);
+	FREE(entry);
+	i--;  /* hash_remove() may have moved another entry into slot i */
+    }
+}
+
+/* The session file holds a "host port" line before each PEM session. */
+static void sslsessions_save(void)
+{
+    const char *name;
+    FILE *fp;
+    int i, fd;
+    SslSession *entry;
+
+    if (!ssl_session_file || !*ssl_session_file) return;
+    name = expand_filename(ssl_session_file);
+    /* sessions contain secrets, so only the user may read the file */
+    if ((fd = open(name, O_WRONLY | O_CREAT | O_TRUNC, 0600)) < 0 ||
+	!(fp = fdopen(fd, "w")))
+    {
+	eprintf("%s: %s", name, strerror(errno));
+	if (fd >= 0) close(fd);
+	return;
+    }
+    for (i = 0; i < sslsessions->size; i++) {
+	if (!(entry = sslsessions->slot[i].datum)) continue;
+	fprintf(fp, "%s\n", entry->key);
+	PEM_write_SSL_SESSION(fp, entry->session);
+    }
+    fclose(fp);
+}
+
+static void sslsessions_load(void)
+{
+    const char *name;
+    FILE *fp;
+    char key[1024];
+    SSL_SESSION *session;
+
+    if (!ssl_session_file || !*ssl_session_file) return;
+    name = expand_filename(ssl_session_file);
+    if (!(fp = fopen(name, "r"))) return;  /* not there yet */
+    while (fgets(key, sizeof(key), fp)) {
+	key[strcspn(key, "\n")] = '\0';
+	if (!(session = PEM_read_SSL_SESSION(fp, NULL, NULL, NULL))) break;
+	sslsession_store(key, session);
+    }
+    fclose(fp);
+}
+
+/* Called by OpenSSL when the server gives us a session we could resume. */
+static int ssl_new_session(SSL *ssl, SSL_SESSION *session)
+{
+    Sock *sock = SSL_get_app_data(ssl);
+
+    if (!sock || !sock->world->host) return 0;
+    sslsession_store(sslsession_key(sock->world), session);
+    sslsessions_save();
+    return 1;  /* we keep the reference */
+}
+
+/* Offer the server the last session we had with it, if still valid. */
+static void ssl_resume(Sock *sock)
+{
+    SslSession *entry;
+    SSL_SESSION *session;
+
+    if (!sock->world->host) return;
+    if (!(entry = hash_find(sslsession_key(sock->world), sslsessions)))
+	return;
+    session = entry->session;
+    if (SSL_SESSION_get_time(session) + SSL_SESSION_get_timeout(session) <
+	time(NULL)
+#if OPENSSL_VERSION_NUMBER >= 0x10101000L
+	|| !SSL_SESSION_is_resumable(session)
+#endif
+	)
+    {
+	hash_remove(entry, sslsessions);
+	SSL_SESSION_free(session);
+	FREE(entry);
+	return;
+    }
+    SSL_set_session(sock->ssl, session);
+}
+#endif /* HAVE_SSL */
+
+/* Called when a setting that affects the SSL context changes.  The context
+ * and remembered sessions are discarded, and recreated on next use. */
+int ch_ssl(Var *var)
+{
+#if HAVE_SSL
+    if (ssl_ctx) {
+	SSL_CTX_free(ssl_ctx);  /* existing SSLs keep their reference */
+	ssl_ctx = NULL;
+	sslsessions_clear();
+    }
+#endif
+    return 1;
+}
+
+#if HAVE_SSL
 static void init_ssl(void)
 {
+    if (ssl_ctx) return;
     SSL_load_error_strings();
     SSL_library_init();
     /* XXX seed PRNG */
@@ -702,6 +949,11 @@ static void init_ssl(void)
 	    eprintf("ssl: SSL_CTX_load_verify_locations: ssl_ca_dir=%s", ssl_ca_dir);
 	}
     }
+    /* We keep sessions ourselves, by world address, in sslsessions. */
+    SSL_CTX_set_session_cache_mode(ssl_ctx,
+	SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+    SSL_CTX_sess_set_new_cb(ssl_ctx, ssl_new_session);
+    sslsessions_load();
 }
 #endif
 
@@ -716,10 +968,15 @@ void init_sock(void)
     FD_ZERO(&connected);
     FD_SET(STDIN_FILENO, &readers);
     nfds = 1;
+    init_list(connect_queue);
 
     set_var_by_id(VAR_async_conn, !!TF_NONBLOCK);
 #ifdef NONBLOCKING_GETHOST
     set_var_by_id(VAR_async_name, 1);
+    init_hashtable(namecache, "hostnames", 16, strstructcmp);
+#endif
+#if HAVE_SSL
+    init_hashtable(sslsessions, "sslsessions", 16, strstructcmp);
 #endif
 
     for (i = 0; i < 0x100; i++) telnet_label[i] = NULL;
@@ -742,6 +999,7 @@ void init_sock(void)
     telnet_label[(UCHAR)TN_CHARSET]	= "CHARSET";
     telnet_label[(UCHAR)TN_COMPRESS]	= "COMPRESS";
     telnet_label[(UCHAR)TN_COMPRESS2]	= "COMPRESS2";
+    telnet_label[(UCHAR)TN_COMPRESS3]	= "COMPRESS3";
     telnet_label[(UCHAR)TN_ATCP]	= "ATCP";
     telnet_label[(UCHAR)TN_GMCP]	= "GMCP";
     telnet_label[(UCHAR)TN_102]		= "102";
@@ -853,6 +1111,20 @@ void main_loop(void)
         if (prompt_timeout.tv_sec > 0) {
 	    set_min_earliest(prompt_timeout);
 	}
+        if (attempt_timeout.tv_sec > 0) {
+            if (tvcmp(&attempt_timeout, &now) <= 0)
+                run_attempts();
+            if (attempt_timeout.tv_sec > 0)
+                set_min_earliest(attempt_timeout);
+        }
+        if (connect_queue->head)
+            run_connect_queue();
+
+        /* send output held during this pass, in one write per socket */
+        /* must be after all possible output and before select() */
+        if (batched_socks)
+            flush_batches();
+        loop_pass++;
 
         /* flush pending display_screen output */
         /* must be after all possible output and before select() */
@@ -906,7 +1178,7 @@ void main_loop(void)
 
         /* Wait for next event.
          *   descriptor read:	user input, socket input, or /quote !
-         *   descriptor write:	nonblocking connect()
+         *   descriptor write:	nonblocking connect(), or queued output
          *   timeout:		time for runall() or do_refresh()
          * Note: if the same descriptor appears in more than one fd_set, some
          * systems count it only once, some count it once for each occurance.
@@ -936,10 +1208,12 @@ void main_loop(void)
             if (pending_input || FD_ISSET(STDIN_FILENO, &active)) {
                 if (FD_ISSET(STDIN_FILENO, &active)) count--;
                 do_refresh();
+                handling_keys++;
                 if (!handle_keyboard_input(FD_ISSET(STDIN_FILENO, &active))) {
                     /* input is at EOF, stop reading it */
                     FD_CLR(STDIN_FILENO, &readers);
                 }
+                handling_keys--;
             }
 
             /* Check for socket completion/activity.  We pick up where we
@@ -957,21 +1231,49 @@ void main_loop(void)
 		    prompt_timeout.tv_sec > 0)
 		{
                     xsock = sock;
+                    if (sock->nattempts && sock->constate == SS_CONNECTING)
+                        count -= poll_attempts(sock);
                     if (sock->constate >= SS_OPEN) {
                         /* do nothing */
-                    } else if (FD_ISSET(xsock->fd, &connected)) {
+                    } else if (FD_ISSET(xsock->fd, &connected) &&
+                        xsock->constate != SS_CONNECTED)
+                    {
                         count--;
                         establish(xsock);
-                    } else if (FD_ISSET(xsock->fd, &active)) {
-                        count--;
-                        if (xsock->constate == SS_RESOLVING) {
-                            openconn(xsock);
-                        } else if (xsock->constate == SS_CONNECTING) {
-                            establish(xsock);
-                        } else if (xsock == fsock || background) {
-                            received += handle_socket_input(NULL, 0, NULL);
-                        } else {
-                            FD_CLR(xsock->fd, &readers);
+                    } else if (xsock->handshaking) {
+                        int ready = 0;
+                        if (FD_ISSET(xsock->fd, &connected)) ready++;
+                        if (FD_ISSET(xsock->fd, &active)) ready++;
+                        if (ready) {
+                            count -= ready;
+                            establish(xsock);  /* continue SSL handshake */
+                        }
+                    } else {
+                        if (FD_ISSET(xsock->fd, &connected)) {
+                            count--;
+                            flush_outqueue();  /* may kill xsock */
+                        }
+                        if (xsock->write_wants_read &&
+                            FD_ISSET(xsock->fd, &active))
+                        {
+                            /* input SSL_write() was waiting for */
+                            xsock->write_wants_read = 0;
+                            flush_outqueue();  /* may kill xsock */
+                        }
+                        if (xsock->constate < SS_OPEN &&
+                            FD_ISSET(xsock->fd, &active))
+                        {
+                            count--;
+                            if (xsock->constate == SS_RESOLVING) {
+                                openconn(xsock);
+                            } else if (xsock->constate == SS_CONNECTING) {
+                                establish(xsock);
+                            } else if (xsock == fsock || background) {
+                                received +=
+                                    handle_socket_input(NULL, 0, NULL);
+                            } else {
+                                FD_CLR(xsock->fd, &readers);
+                            }
                         }
                     }
 		    if (xsock->queue.list.head)
@@ -1009,6 +1311,9 @@ void main_loop(void)
 #endif
         }
 
+        /* run coalesced hooks once for everything received above */
+        run_deferred_hooks();
+
         if (pending_line && read_depth) {    /* end of tf read() */
             pending_line = FALSE;
             break;
@@ -1083,6 +1388,31 @@ int tog_bg(Var *var)
     return 1;
 }
 
+/* Batching does the job of Nagle's algorithm, without delaying the first
+ * line of a pass, so turn Nagle off while batching. */
+static void set_nodelay(int fd)
+{
+#ifdef TCP_NODELAY
+    int flags = (send_batch != BATCH_OFF);
+    if (setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, (void*)&flags,
+	sizeof(flags)) < 0)
+    {
+	tf_wprintf("setsockopt TCP_NODELAY: %s", strerror(errno));
+    }
+#endif
+}
+
+int ch_send_batch(Var *var)
+{
+    Sock *sock;
+
+    for (sock = hsock; sock; sock = sock->next) {
+	if (sock->constate == SS_CONNECTED)
+	    set_nodelay(sock->fd);
+    }
+    return 1;
+}
+
 int tog_keepalive(Var *var)
 {
     Sock *sock;
@@ -1320,6 +1650,75 @@ int openworld(const char *name, const char *port, int flags)
     return world ? opensock(world, flags) : 0;
 }
 
+/* Count sockets whose name lookup, connection, or handshake is pending. */
+static int connecting_socks(void)
+{
+    Sock *sock;
+    int n = 0;
+
+    for (sock = hsock; sock; sock = sock->next) {
+	if ((sock->constate > SS_NEW && sock->constate < SS_CONNECTED) ||
+	    (sock->constate == SS_CONNECTED && sock->handshaking))
+	    n++;
+    }
+    return n;
+}
+
+/* Open queued worlds while fewer than %max_connecting are in progress. */
+static void run_connect_queue(void)
+{
+    PendingConn *pc;
+    Sock *oldxsock = xsock;
+
+    while (connect_queue->head &&
+	(max_connecting <= 0 || connecting_socks() < max_connecting))
+    {
+	pc = (PendingConn *)unlist(connect_queue->head, connect_queue);
+	openworld(pc->name, NULL, pc->flags);
+	FREE(pc->name);
+	FREE(pc);
+    }
+    xsock = oldxsock;
+}
+
+/* Open each world in the space-separated list names concurrently, with at
+ * most %max_connecting in progress at once; the rest are queued until
+ * others finish.  Only the first world may come to the foreground.
+ * Returns the number of worlds opened or queued.
+ */
+int openworlds(const char *names, int flags)
+{
+    const char *start;
+    char *name;
+    PendingConn *pc;
+    int n = 0;
+
+    if (!(flags & (CONN_FG | CONN_BG)))
+	flags |= (xsock == fsock) ? CONN_FG : CONN_BG;
+    flags |= CONN_NOWAIT;
+
+    while (*names) {
+	while (is_space(*names)) names++;
+	if (!*names) break;
+	for (start = names; *names && !is_space(*names); names++);
+	name = strncpy(XMALLOC(names - start + 1), start, names - start);
+	name[names - start] = '\0';
+	if (!find_world(name)) {
+	    eprintf("%s: no such world", name);
+	    FREE(name);
+	    continue;
+	}
+	pc = XMALLOC(sizeof(PendingConn));
+	pc->name = name;
+	pc->flags = flags;
+	inlist(pc, connect_queue, connect_queue->tail);
+	flags = (flags & ~CONN_FG) | CONN_BG;
+	n++;
+    }
+    run_connect_queue();
+    return n;
+}
+
 static int opensock(World *world, int flags)
 {
     int gai_err;
@@ -1363,8 +1762,26 @@ static int opensock(World *world, int flags)
 	xsock->ssl = NULL;
 #endif
     }
+    xsock->lastaddr = NULL;
+    xsock->nattempts = 0;
+    xsock->next_attempt = tvzero;
     Stringninit(xsock->buffer, 80);  /* data must be allocated */
     Stringninit(xsock->subbuffer, 1);
+    Stringninit(xsock->outqueue, 1);
+    xsock->outqueue_off = 0;
+    xsock->backlogged = 0;
+    xsock->write_wants_read = 0;
+    xsock->batched = 0;
+    xsock->sendpass = 0;
+    xsock->bytes[SOCK_RECV] = xsock->bytes[SOCK_SEND] = 0;
+    xsock->lines[SOCK_RECV] = xsock->lines[SOCK_SEND] = 0;
+    xsock->calls[SOCK_RECV] = xsock->calls[SOCK_SEND] = 0;
+    xsock->qdepth = xsock->qmax = 0;
+    memset(&xsock->display_lat, 0, sizeof(Latency));
+    memset(&xsock->key_lat, 0, sizeof(Latency));
+    xsock->keypending = tvzero;
+    xsock->nowait = !!(flags & CONN_NOWAIT);
+    xsock->handshaking = 0;
     init_queue(&xsock->queue);
     xsock->host = NULL;
     xsock->port = NULL;
@@ -1386,6 +1803,12 @@ static int opensock(World *world, int flags)
     xsock->alert_id = 0;
 #if HAVE_MCCP
     xsock->zstream = NULL;
+    xsock->zbuffer = NULL;
+    xsock->zbufsize = 0;
+    xsock->zin = xsock->zout = 0;
+    xsock->ztime = tvzero;
+    xsock->ozstream = NULL;
+    xsock->ozin = xsock->ozout = 0;
 #endif
     VEC_ZERO(&xsock->tn_them);
     VEC_ZERO(&xsock->tn_them_tog);
@@ -1415,13 +1838,20 @@ static int opensock(World *world, int flags)
 	// Note: set_verify() needs to b ecalled *before* SSL_new()
     	SSL_CTX_set_verify(ssl_ctx, SSL_VERIFY_PEER, ssl_verify_callback);
 	xsock->ssl = SSL_new(ssl_ctx);
+	/* sock_write() may retry a write from a different place in outqueue */
+	SSL_set_mode(xsock->ssl,
+	    SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
 	SSL_CTX_set_verify_depth(ssl_ctx, ssl_depth);
-	ssl_mydata_index = SSL_get_ex_new_index(0, "ssl_mydata index", 
+	/* one index for all sockets, since handshakes can overlap */
+	if (ssl_mydata_index < 0)
+	    ssl_mydata_index = SSL_get_ex_new_index(0, "ssl_mydata index",
 		NULL, NULL, NULL);
 	ssl_options.verify_depth = ssl_depth;
 	ssl_options.verbose_mode = ssl_verbose;
 	ssl_options.always_continue = ssl_continue;
 	SSL_set_ex_data(xsock->ssl, ssl_mydata_index, &ssl_options);
+	SSL_set_app_data(xsock->ssl, xsock);
+	ssl_resume(xsock);
 #if OPENSSL_VERSION_NUMBER >= 0x1000200fL
 	X509_VERIFY_PARAM *param = SSL_get0_param(xsock->ssl);
 	X509_VERIFY_PARAM_set_hostflags(param, 
@@ -1440,13 +1870,13 @@ static int opensock(World *world, int flags)
     } else if (!(world->flags & WORLD_NOPROXY) && proxy_host && *proxy_host) {
 	/* open a connection through a proxy */
         xsock->flags |= SOCKPROXY;
-        xsock->host = STRDUP(proxy_host);
-        xsock->port = (proxy_port && *proxy_port) ? proxy_port : "23";
-        xsock->port = STRDUP(xsock->port);
+        xsock->host = intern(proxy_host, -1);
+        xsock->port = intern((proxy_port && *proxy_port) ? proxy_port : "23",
+	    -1);
     } else {
 	/* open a connection directly */
-        xsock->host = STRDUP(world->host);
-        xsock->port = STRDUP(world->port);
+        xsock->host = intern(world->host, -1);
+        xsock->port = intern(world->port, -1);
     }
 
     xsock->flags |= SOCKMAYTELNET;
@@ -1481,6 +1911,7 @@ static int opensock(World *world, int flags)
     if (xsock->fd == 0) {
         /* The name lookup succeeded */
         xsock->constate = SS_RESOLVED;
+	interleave_addrs(xsock->addrs);
 	xsock->addr = xsock->addrs;
         return openconn(xsock);
 #ifdef NONBLOCKING_GETHOST
@@ -1494,7 +1925,9 @@ static int opensock(World *world, int flags)
         FD_SET(xsock->fd, &readable);
         tv.tv_sec = 0;
         tv.tv_usec = CONN_WAIT;
-        if (select(xsock->fd + 1, &readable, NULL, NULL, &tv) > 0) {
+        if (!xsock->nowait &&
+            select(xsock->fd + 1, &readable, NULL, NULL, &tv) > 0)
+        {
             /* The lookup completed. */
             return openconn(xsock);
         }
@@ -1557,12 +1990,50 @@ static inline int ai_connect(int s, struct addrinfo *ai)
     return connect(s, ai->ai_addr, ai->ai_addrlen);
 }
 
-static void setupnextconn(Sock *sock)
+/* Reorder addrs so that address families alternate after the first, as
+ * recommended by RFC 8305.  The head stays first, so the list can still be
+ * freed through it. */
+static void interleave_addrs(struct addrinfo *addrs)
 {
-    struct addrinfo *ai, *next = sock->addr;
+    struct addrinfo *same = NULL, **sametail = &same;
+    struct addrinfo *other = NULL, **othertail = &other;
+    struct addrinfo *ai, *next, **tail;
+
+    if (!addrs) return;
+    for (ai = addrs->ai_next; ai; ai = next) {
+	next = ai->ai_next;
+	if (ai->ai_family == addrs->ai_family) {
+	    *sametail = ai;
+	    sametail = &ai->ai_next;
+	} else {
+	    *othertail = ai;
+	    othertail = &ai->ai_next;
+	}
+    }
+    *sametail = *othertail = NULL;
+
+    tail = &addrs->ai_next;
+    while (same || other) {
+	if (other) {
+	    *tail = other;
+	    tail = &other->ai_next;
+	    other = other->ai_next;
+	}
+	if (same) {
+	    *tail = same;
+	    tail = &same->ai_next;
+	    same = same->ai_next;
+	}
+    }
+    *tail = NULL;
+}
+
+/* Return the address after the last one we started on, skipping any that
+ * duplicate one we've already done. */
+static struct addrinfo *nextaddr(Sock *sock)
+{
+    struct addrinfo *ai, *next = sock->lastaddr;
 
-    if (sock->fd >= 0)
-	close(sock->fd);
 retry:
     next = next->ai_next;
     /* if next address is a duplicate of one we've already done, skip it */
@@ -1571,19 +2042,151 @@ retry:
 	    goto retry;
 	}
     }
-    sock->addr = next;
+    return next;
+}
+
+static void setupnextconn(Sock *sock)
+{
+    if (sock->fd >= 0) {
+        FD_CLR(sock->fd, &readers);
+        FD_CLR(sock->fd, &writers);
+	close(sock->fd);
+	sock->fd = -1;
+    }
+    sock->addr = nextaddr(sock);
+}
+
+/* Make sock's pending attempt i its current attempt.  The current attempt,
+ * if there is one, takes its place in attempt[]. */
+static void use_attempt(Sock *sock, int i)
+{
+    Attempt a = sock->attempt[i];
+
+    if (sock->fd >= 0) {
+	sock->attempt[i].fd = sock->fd;
+	sock->attempt[i].addr = sock->addr;
+    } else {
+	sock->attempt[i] = sock->attempt[--sock->nattempts];
+    }
+    sock->fd = a.fd;
+    sock->addr = a.addr;
+#if HAVE_SSL
+    if (sock->ssl)
+	SSL_set_fd(sock->ssl, sock->fd);
+#endif
+}
+
+static void drop_attempt(Sock *sock, int i)
+{
+    FD_CLR(sock->attempt[i].fd, &readers);
+    FD_CLR(sock->attempt[i].fd, &writers);
+    close(sock->attempt[i].fd);
+    sock->attempt[i] = sock->attempt[--sock->nattempts];
+}
+
+static void cancel_attempts(Sock *sock)
+{
+    while (sock->nattempts)
+	drop_attempt(sock, 0);
+    sock->next_attempt = tvzero;
+}
+
+/* Start connecting to sock's next address without giving up on the current
+ * one ("happy eyeballs"). */
+static int start_attempt(Sock *sock)
+{
+    sock->next_attempt = tvzero;
+    if (sock->constate != SS_CONNECTING || sock->nattempts >= MAX_ATTEMPTS)
+	return 0;
+    sock->attempt[sock->nattempts].fd = sock->fd;
+    sock->attempt[sock->nattempts].addr = sock->addr;
+    sock->nattempts++;
+    sock->fd = -1;
+    setupnextconn(sock);
+    if (!sock->addr) {
+	/* nothing left to try after all */
+	use_attempt(sock, sock->nattempts - 1);
+	return 0;
+    }
+    return openconn(sock);
+}
+
+/* Start any parallel connection attempts that are due. */
+static void run_attempts(void)
+{
+    Sock *sock, *oldxsock = xsock;
+    struct timeval now;
+
+    gettime(&now);
+    attempt_timeout = tvzero;
+    for (sock = hsock; sock; sock = sock->next) {
+	if (!sock->next_attempt.tv_sec) continue;
+	if (tvcmp(&sock->next_attempt, &now) <= 0)
+	    start_attempt(sock);
+	if (sock->next_attempt.tv_sec && (!attempt_timeout.tv_sec ||
+	    tvcmp(&sock->next_attempt, &attempt_timeout) < 0))
+	{
+	    attempt_timeout = sock->next_attempt;
+	}
+    }
+    xsock = oldxsock;
+}
+
+/* Check sock's older pending attempts for completion.  Failed attempts are
+ * dropped; the first to connect replaces the current attempt, and is then
+ * established.  Returns the number of descriptors that were ready. */
+static int poll_attempts(Sock *sock)
+{
+    int i, fd, err, n = 0;
+    socklen_t len;
+
+    for (i = 0; i < sock->nattempts; ) {
+	fd = sock->attempt[i].fd;
+	if (!FD_ISSET(fd, &connected) && !FD_ISSET(fd, &active)) {
+	    i++;
+	    continue;
+	}
+	if (FD_ISSET(fd, &connected)) n++;
+	if (FD_ISSET(fd, &active)) n++;
+	FD_CLR(fd, &connected);
+	FD_CLR(fd, &active);
+	err = 0;
+	len = sizeof(err);
+#ifdef PARALLEL_CONNECT
+	if (getsockopt(fd, SOL_SOCKET, SO_ERROR, (void*)&err, &len) < 0)
+	    err = errno;
+#endif
+	if (err) {
+	    do_hook(H_ICONFAIL, ICONFAIL_fmt, "%s %s: %s", sock->world->name,
+		printai(sock->attempt[i].addr, NULL), strerror(err));
+	    drop_attempt(sock, i);
+	    continue;
+	}
+	/* This one won.  Forget the rest, and get on with it. */
+	use_attempt(sock, i);
+	cancel_attempts(sock);
+	establish(sock);
+	break;
+    }
+    return n;
 }
 
 /* If there are more addresses to try, hook ICONFAIL and try the next;
- * otherwise, hook CONFAIL and give up. */
+ * otherwise, if older attempts are still pending, hook ICONFAIL and wait
+ * for them; otherwise, hook CONFAIL and give up. */
 static int ICONFAIL(Sock *sock, const char *what, const char *why)
 {
     setupnextconn(sock);
 
-    if (sock->addr) {
+    if (sock->addr || sock->nattempts) {
 	do_hook(H_ICONFAIL, ICONFAIL_fmt, "%s %s: %s",
 	    (sock)->world->name, (what), (why));
 	oflush();
+	if (!sock->addr) {
+	    sock->next_attempt = tvzero;
+	    use_attempt(sock, sock->nattempts - 1);
+	    return 2;
+	}
 	return openconn(sock);
     }
     do_hook(H_CONFAIL, "%% Connection to %s failed: %s: %s", "%s %s: %s",
@@ -1601,7 +2204,6 @@ static int openconn(Sock *sock)
 #ifdef NONBLOCKING_GETHOST
     if (xsock->constate == SS_RESOLVING) {
 	nbgai_hdr_t info = { 0, 0 };
-	struct addrinfo *ai;
         FD_CLR(xsock->fd, &readers);
         if (read(xsock->fd, &info, sizeof(info)) < 0 || info.err != 0) {
             if (!info.err)
@@ -1623,7 +2225,9 @@ static int openconn(Sock *sock)
 	    xsock->addrs = NULL;
 	} else {
 	    xsock->addrs = XMALLOC(info.size);
-	    read(xsock->fd, (char*)xsock->addrs, info.size);
+	    if (read(xsock->fd, (char*)xsock->addrs, info.size) == info.size)
+		namecache_store(xsock->host, xsock->port,
+		    (char*)xsock->addrs, info.size);
 	}
         close(xsock->fd);
 # ifdef PLATFORM_UNIX
@@ -1633,13 +2237,8 @@ static int openconn(Sock *sock)
         xsock->pid = -1;
 # endif /* PLATFORM_UNIX */
         xsock->constate = SS_RESOLVED;
-	for (ai = xsock->addrs; ai; ai = ai->ai_next) {
-	    ai->ai_addr = (struct sockaddr*)((char*)ai + sizeof(*ai));
-	    if (ai->ai_next != 0) {
-		ai->ai_next = 
-		    (struct addrinfo*)((char*)ai->ai_addr + ROUND_UP_LENGTH(ai->ai_addrlen));
-	    }
-	}
+	unpack_addrinfo(xsock->addrs);
+	interleave_addrs(xsock->addrs);
 	xsock->addr = xsock->addrs;
     }
 #endif /* NONBLOCKING_GETHOST */
@@ -1657,6 +2256,7 @@ static int openconn(Sock *sock)
 	return 0;
     }
 
+    xsock->lastaddr = xsock->addr;
     xsock->fd = socket(xsock->addr->ai_family, xsock->addr->ai_socktype,
 	xsock->addr->ai_protocol);
     if (xsock->fd < 0) {
@@ -1706,28 +2306,42 @@ static int openconn(Sock *sock)
 	    tf_wprintf("setsockopt KEEPALIVE: %s", strerror(errno));
 	}
     }
+    if (send_batch != BATCH_OFF)
+	set_nodelay(xsock->fd);
 
     xsock->constate = SS_CONNECTING;
     if (ai_connect(xsock->fd, xsock->addr) == 0) {
         /* The connection completed successfully. */
         xsock->constate = SS_CONNECTED;
+        cancel_attempts(xsock);
         return establish(xsock);
 
 #ifdef EINPROGRESS
     } else if (errno == EINPROGRESS) {
         /* The connection needs more time.  It will select() as writable when
          * it has connected, or readable when it has failed.  We select() it
-         * briefly here so "fast" looks synchronous to the user.
+         * briefly here so "fast" looks synchronous to the user.  If there
+         * are more addresses, we start on the next one after %connect_delay
+         * without abandoning this one.
          */
         fd_set writeable;
         struct timeval tv;
-        FD_ZERO(&writeable);
-        FD_SET(xsock->fd, &writeable);
-        tv.tv_sec = 0;
-        tv.tv_usec = CONN_WAIT;
-        if (select(xsock->fd + 1, NULL, &writeable, NULL, &tv) > 0) {
-            /* The connection completed. */
-            return establish(xsock);
+        int stagger = 0, briefwait = !xsock->nattempts && !xsock->nowait;
+#ifdef PARALLEL_CONNECT
+        stagger = tvcmp(&connect_delay, &tvzero) > 0 &&
+            xsock->nattempts < MAX_ATTEMPTS && nextaddr(xsock);
+#endif
+        if (briefwait) {
+            FD_ZERO(&writeable);
+            FD_SET(xsock->fd, &writeable);
+            tv.tv_sec = 0;
+            tv.tv_usec = CONN_WAIT;
+            if (stagger && tvcmp(&connect_delay, &tv) < 0)
+                tv = connect_delay;
+            if (select(xsock->fd + 1, NULL, &writeable, NULL, &tv) > 0) {
+                /* The connection completed. */
+                return establish(xsock);
+            }
         }
         /* select() returned 0, or -1 and errno==EINTR.  Either way, the
          * connection needs more time.  So we add the fd to the set being
@@ -1735,6 +2349,17 @@ static int openconn(Sock *sock)
          */
         FD_SET(xsock->fd, &writers);
         FD_SET(xsock->fd, &readers);
+        if (stagger) {
+            gettime(&xsock->next_attempt);
+            if (!briefwait)
+                tvadd(&xsock->next_attempt, &xsock->next_attempt,
+                    &connect_delay);
+            if (!attempt_timeout.tv_sec ||
+                tvcmp(&xsock->next_attempt, &attempt_timeout) < 0)
+            {
+                attempt_timeout = xsock->next_attempt;
+            }
+        }
         return 2;
 #endif /* EINPROGRESS */
 
@@ -1900,6 +2525,8 @@ static int get_host_address(Sock *sock, const char **what, int *errp)
 	*errp = 0;
 	*what = NULL;
 	sock->flags |= SOCKALLOCADDRS;
+	if ((sock->addrs = namecache_find(sock->host, sock->port)))
+	    return 0;
 	return nonblocking_gethost(sock->host, sock->port, &sock->addrs,
 	    &sock->pid, what);
     } else
@@ -1966,13 +2593,25 @@ static void waitforhostname(int fd, const char *name, const char *port)
     close(fd);
 }
 
-# ifdef PLATFORM_OS2
 typedef struct _threadpara {
     const char *hostname;
     const char *port;
     int   fd;
 } threadpara;
 
+# ifdef THREADED_GETHOST
+/* The thread must not use tf's allocator, so targs and its strings were
+ * allocated together with malloc(), and are freed with free(). */
+static void *waitforhostname_thread(void *arg)
+{
+    threadpara *targs = arg;
+    waitforhostname(targs->fd, targs->hostname, targs->port);
+    free(targs);
+    return NULL;
+}
+# endif /* THREADED_GETHOST */
+
+# ifdef PLATFORM_OS2
 void os2waitforhostname(threadpara *targs)
 {
     waitforhostname(targs->fd, targs->hostname, targs->port);
@@ -1991,7 +2630,37 @@ static int nonblocking_gethost(const char *name, const char *port,
     *what = "pipe";
     if (pipe(fds) < 0) return -1;
 
-#ifdef PLATFORM_UNIX
+#ifdef THREADED_GETHOST
+    {
+	size_t namelen = strlen(name) + 1, portlen = strlen(port) + 1;
+	threadpara *tpara;
+	pthread_t thread;
+	pthread_attr_t attr;
+	sigset_t all, old;
+
+	*what = "malloc";
+	if ((tpara = malloc(sizeof(threadpara) + namelen + portlen))) {
+	    tpara->fd = fds[1];
+	    tpara->hostname = memcpy((char*)(tpara + 1), name, namelen);
+	    tpara->port = memcpy((char*)(tpara + 1) + namelen, port, portlen);
+	    /* Signals must be handled by the main thread. */
+	    sigfillset(&all);
+	    pthread_sigmask(SIG_SETMASK, &all, &old);
+	    pthread_attr_init(&attr);
+	    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	    err = pthread_create(&thread, &attr, waitforhostname_thread, tpara);
+	    pthread_attr_destroy(&attr);
+	    pthread_sigmask(SIG_SETMASK, &old, NULL);
+	    if (err == 0) {
+		*pidp = -1;
+		return fds[0];  /* thread will close fds[1] */
+	    }
+	    free(tpara);
+	    errno = err;
+	}
+	*what = "pthread_create";
+    }
+#elif defined(PLATFORM_UNIX)
     {
         *what = "fork";
         *pidp = fork();
@@ -2031,6 +2700,72 @@ static int nonblocking_gethost(const char *name, const char *port,
     errno = err;
     return -1;
 }
+
+/* Fix the pointers in a packed list of addrinfos written by
+ * waitforhostname(), so it can be used in this process. */
+static void unpack_addrinfo(struct addrinfo *ai)
+{
+    for ( ; ai; ai = ai->ai_next) {
+	ai->ai_addr = (struct sockaddr*)((char*)ai + sizeof(*ai));
+	if (ai->ai_next != 0) {
+	    ai->ai_next = 
+		(struct addrinfo*)((char*)ai->ai_addr + ROUND_UP_LENGTH(ai->ai_addrlen));
+	}
+    }
+}
+
+static const char *namecache_key(const char *host, const char *port)
+{
+    STATIC_BUFFER(key);
+    Sprintf(key, "%s %s", host, port);
+    return key->data;
+}
+
+/* Returns a copy of the cached addresses of host and port, or NULL. */
+static struct addrinfo *namecache_find(const char *host, const char *port)
+{
+    NameCache *entry;
+    struct addrinfo *ai;
+    struct timeval now;
+
+    if (!(entry = hash_find(namecache_key(host, port), namecache)))
+	return NULL;
+    gettime(&now);
+    if (tvcmp(&entry->expires, &now) <= 0) {
+	hash_remove(entry, namecache);
+	FREE(entry);
+	return NULL;
+    }
+    ai = XMALLOC(entry->size);
+    memcpy(ai, entry + 1, entry->size);
+    unpack_addrinfo(ai);
+    return ai;
+}
+
+/* Remember the packed addrinfo list data for host and port. */
+static void namecache_store(const char *host, const char *port,
+    const char *data, int size)
+{
+    NameCache *entry;
+    const char *key;
+    int keylen;
+
+    if (tvcmp(&name_cache, &tvzero) <= 0) return;
+    key = namecache_key(host, port);
+    if ((entry = hash_find(key, namecache))) {
+	hash_remove(entry, namecache);
+	FREE(entry);
+    }
+    keylen = strlen(key) + 1;
+    entry = XMALLOC(sizeof(NameCache) + size + keylen);
+    entry->key = (char*)(entry + 1) + size;
+    memcpy(entry->key, key, keylen);
+    memcpy(entry + 1, data, size);
+    entry->size = size;
+    gettime(&entry->expires);
+    tvadd(&entry->expires, &entry->expires, &name_cache);
+    hash_insert((void *)entry, namecache);
+}
 #endif /* NONBLOCKING_GETHOST */
 #endif /* NETDB_H */
 
@@ -2106,9 +2841,15 @@ static int establish(Sock *sock)
         /* connect() worked.  Clear the pending stuff, and get on with it. */
         xsock->constate = SS_CONNECTED;
         FD_CLR(xsock->fd, &writers);
+        cancel_attempts(xsock);
 
-        /* Turn off nonblocking (this should help on buggy systems). */
+        /* Turn off nonblocking (this should help on buggy systems).  An
+         * SSL socket stays nonblocking, so that neither the handshake nor
+         * SSL_read() of a record with no application data blocks. */
         /* note: 3rd arg to fcntl() is optional on Unix, but required by OS/2 */
+#if HAVE_SSL
+        if (!xsock->ssl)
+#endif
         if ((flags = fcntl(xsock->fd, F_GETFL, 0)) >= 0)
             fcntl(xsock->fd, F_SETFL, flags & ~TF_NONBLOCK);
     }
@@ -2127,6 +2868,18 @@ static int establish(Sock *sock)
 	int sslret;
 	sslret = SSL_connect(xsock->ssl);
 	if (sslret <= 0) {
+	    switch (SSL_get_error(xsock->ssl, sslret)) {
+	    case SSL_ERROR_WANT_READ:
+		/* main_loop() will call us again when there is more to do */
+		xsock->handshaking = 1;
+		FD_CLR(xsock->fd, &writers);
+		return 2;
+	    case SSL_ERROR_WANT_WRITE:
+		xsock->handshaking = 1;
+		FD_SET(xsock->fd, &writers);
+		return 2;
+	    }
+	    xsock->handshaking = 0;
 	    setupnextconn(xsock);
 	    ssl_io_err(xsock, sslret, xsock->addr ? H_ICONFAIL : H_CONFAIL);
 	    if (xsock->addr)
@@ -2134,6 +2887,18 @@ static int establish(Sock *sock)
 	    killsock(xsock);
 	    return 0;
 	}
+	xsock->handshaking = 0;
+	if (xsock->outqueue_off < xsock->outqueue->len)
+	    FD_SET(xsock->fd, &writers);  /* sent during handshake */
+	else
+	    FD_CLR(xsock->fd, &writers);
+	ssl_handshakes++;
+	if (SSL_session_reused(xsock->ssl)) ssl_resumed++;
+	if (ssl_verbose)
+	    do_hook(H_PENDING,
+		"%% SSL: %s session (%d of %d handshakes resumed).",
+		"%s %d %d", SSL_session_reused(xsock->ssl) ? "resumed" : "new",
+		ssl_resumed, ssl_handshakes);
 	ssl_check_cert_verify(sock);
     }
 #endif
@@ -2147,10 +2912,10 @@ static int establish(Sock *sock)
         preferred_telnet_options();
 
     if (sock->flags & SOCKPROXY) {
-        FREE(sock->host);
-        FREE(sock->port);
-        sock->host = STRDUP(sock->world->host);
-        sock->port = STRDUP(sock->world->port);
+        unintern(sock->host);
+        unintern(sock->port);
+        sock->host = intern(sock->world->host, -1);
+        sock->port = intern(sock->world->port, -1);
         do_hook(H_PROXY, "", "%s", sock->world->name);
     }
 
@@ -2216,11 +2981,13 @@ static void killsock(Sock *sock)
     VEC_ZERO(&sock->tn_us_tog);
     Stringfree(sock->buffer);
     Stringfree(sock->subbuffer);
+    Stringfree(sock->outqueue);
+    sock->outqueue_off = 0;
 
     unprompt(sock, sock==fsock);
 
-    if (sock->host) FREE(sock->host);
-    if (sock->port) FREE(sock->port);
+    if (sock->host) unintern(sock->host);
+    if (sock->port) unintern(sock->port);
     if (sock->myhost) FREE(sock->myhost);
     sock->host = sock->port = sock->myhost = NULL;
 
@@ -2247,11 +3014,15 @@ static void killsock(Sock *sock)
         close(sock->fd);
         sock->fd = -1;
     }
-#if HAVE_MCCP
-    if (sock->zstream) {
-	inflateEnd(sock->zstream);
-	FREE(sock->zstream);
+    cancel_attempts(sock);
+    sock->lastaddr = NULL;
+    if (sock->batched) {
+	sock->batched = 0;
+	batched_socks--;
     }
+#if HAVE_MCCP
+    end_zstream(sock);
+    end_mccp3(sock, FALSE);
 #endif
 #ifdef NONBLOCKING_GETHOST
 # ifdef PLATFORM_UNIX
@@ -2280,7 +3051,9 @@ static void nukesock(Sock *sock)
 	    sock->world->name);
 	socks_with_lines--;
     }
+    flush_status_fields();  /* fields may be waiting to evaluate with sock */
     if (sock == xsock) xsock = NULL;
+    forget_deferred_sock(sock);
     sock->world->sock = NULL;
     killsock(sock);
     *((sock == hsock) ? &hsock : &sock->prev->next) = sock->next;
@@ -2352,6 +3125,8 @@ static void queue_socket_line(Sock *sock, const conString *line, int length,
     if (!sock->queue.list.head)
 	socks_with_lines++;
     enqueue(&sock->queue, new);
+    sock->lines[SOCK_RECV]++;
+    if (++sock->qdepth > sock->qmax) sock->qmax = sock->qdepth;
 }
 
 static void dc(Sock *s)
@@ -2703,46 +3478,278 @@ int handle_fake_recv_function(conString *string, const char *world,
 }
 
 
-/* transmit bytes to current socket */
-static int transmit(const char *str, unsigned int numtowrite)
+#ifdef MSG_DONTWAIT
+# define SEND_DONTWAIT	MSG_DONTWAIT
+#else
+# define SEND_DONTWAIT	0	/* send() may block */
+#endif
+
+/* Add the delay since *since to lat. */
+static void lat_add(Latency *lat, const struct timeval *since)
+{
+    struct timeval now;
+    long usec;
+    int i;
+
+    gettime(&now);
+    tvsub(&now, &now, since);
+    usec = (now.tv_sec >= 2000) ? 2000000000L : /* don't overflow */
+	now.tv_sec < 0 ? 0 : now.tv_sec * 1000000L + now.tv_usec;
+    for (i = 0; i < LAT_BUCKETS - 1 && usec >= (1L << i); i++);
+    lat->hist[i]++;
+    lat->n++;
+    lat->total += usec / 1e6;
+    if (usec > lat->max) lat->max = usec;
+}
+
+/* Approximate pct'th percentile of lat, in microseconds:  the top of the
+ * bucket it falls in, which is at most twice the true value. */
+static long lat_percentile(const Latency *lat, int pct)
+{
+    unsigned long want, sum = 0;
+    int i;
+
+    if (!lat->n) return 0;
+    want = (lat->n * pct + 99) / 100;
+    for (i = 0; i < LAT_BUCKETS - 1; i++)
+	if ((sum += lat->hist[i]) >= want) break;
+    return (i < LAT_BUCKETS - 1 && (1L << i) < lat->max) ? (1L << i) : lat->max;
+}
+
+/* Account for a write of n bytes to xsock. */
+static void count_write(int n)
+{
+    if (n <= 0) return;
+    xsock->bytes[SOCK_SEND] += n;
+    xsock->calls[SOCK_SEND]++;
+    if (xsock->keypending.tv_sec) {
+	lat_add(&xsock->key_lat, &xsock->keypending);
+	xsock->keypending = tvzero;
+    }
+}
+
+/* Write up to len bytes to the current socket without blocking.
+ * Returns the number of bytes consumed, or -1 if the connection was lost.
+ */
+static int sock_write(const char *str, unsigned int len)
 {
     int numwritten, err;
 
+#if HAVE_SSL
+    if (xsock->ssl) {
+	/* The socket is otherwise blocking, for the sake of SSL_read(). */
+	int flags = TF_NONBLOCK ? fcntl(xsock->fd, F_GETFL, 0) : -1;
+	if (flags >= 0) fcntl(xsock->fd, F_SETFL, flags | TF_NONBLOCK);
+	numwritten = SSL_write(xsock->ssl, str, len);
+	err = (numwritten > 0) ? SSL_ERROR_NONE :
+	    SSL_get_error(xsock->ssl, numwritten);
+	if (flags >= 0) fcntl(xsock->fd, F_SETFL, flags);
+	/* If SSL needs to read (e.g., a renegotiation) before it can write,
+	 * waiting for writability would just spin; wait for input instead. */
+	xsock->write_wants_read = (err == SSL_ERROR_WANT_READ);
+	if (err == SSL_ERROR_NONE) {
+	    count_write(numwritten);
+	    return numwritten;
+	}
+	if (err == SSL_ERROR_WANT_WRITE || err == SSL_ERROR_WANT_READ)
+	    return 0;
+	zombiesock(xsock); /* before hook, so sock state is correct */
+	ssl_io_err(xsock, numwritten, H_DISCONNECT);
+	return -1;
+    }
+#endif /* HAVE_SSL */
+
+    numwritten = send(xsock->fd, str, len, SEND_DONTWAIT);
+    if (numwritten >= 0) {
+	count_write(numwritten);
+	return numwritten;
+    }
+    err = errno;
+    if (err == EINTR || err == EAGAIN
+#ifdef EWOULDBLOCK
+	|| err == EWOULDBLOCK
+#endif
+	)
+    {
+	return 0;  /* try again when writable */
+    } else if (err == EHOSTUNREACH || err == ENETUNREACH) {
+	/* XXX there should be an UNREACHABLE hook here */
+	eprintf("%s: send: %s", xsock->world->name, strerror(err));
+	return len;  /* discard it */
+    } else {
+	flushxsock();
+	zombiesock(xsock); /* before hook, so state is correct */
+	DISCON(xsock->world->name, "send", strerror(err));
+	return -1;
+    }
+}
+
+/* Send as much of the current socket's queued output as it will accept
+ * without blocking, and select() it for writing while any remains.
+ * Returns 0 if the connection was lost.
+ */
+static int flush_outqueue(void)
+{
+    String *queue = xsock->outqueue;
+    int numwritten;
+
+    while (xsock->outqueue_off < queue->len) {
+	numwritten = sock_write(queue->data + xsock->outqueue_off,
+	    queue->len - xsock->outqueue_off);
+	if (numwritten < 0) return 0;
+	if (numwritten == 0) break;
+	xsock->outqueue_off += numwritten;
+	gettime(&xsock->time[SOCK_SEND]);
+    }
+    if (xsock->outqueue_off < queue->len) {
+	if (xsock->write_wants_read)
+	    FD_CLR(xsock->fd, &writers);  /* retried when fd is readable */
+	else
+	    FD_SET(xsock->fd, &writers);
+    } else {
+	FD_CLR(xsock->fd, &writers);
+	Stringtrunc(queue, 0);
+	xsock->outqueue_off = 0;
+	xsock->backlogged = 0;
+    }
+    return 1;
+}
+
+/* transmit bytes to current socket, compressed if MCCP v3 is on.  Each
+ * call is flushed through the compressor, so the server can act on it
+ * without waiting for more.
+ */
+static int transmit(const char *str, unsigned int numtowrite)
+{
+    int hold;
+
     if (!xsock || xsock->constate != SS_CONNECTED)
         return 0;
-    while (numtowrite) {
-#if HAVE_SSL
-	if (xsock->ssl) {
-	    numwritten = SSL_write(xsock->ssl, str, numtowrite);
-	    if (numwritten <= 0) {
-		zombiesock(xsock); /* before hook, so sock state is correct */
-		ssl_io_err(xsock, numwritten, H_DISCONNECT);
+    if (handling_keys && !xsock->keypending.tv_sec)
+	xsock->keypending = keyboard_time;
+    hold = hold_output();
+#if HAVE_MCCP
+    if (xsock->ozstream) {
+	/* held output is flushed through the compressor with the batch */
+	char zbuf[BUFFSIZE];
+	z_stream *zs = xsock->ozstream;
+	zs->next_in = (Bytef*)str;
+	zs->avail_in = numtowrite;
+	do {
+	    zs->next_out = (Bytef*)zbuf;
+	    zs->avail_out = sizeof(zbuf);
+	    if (deflate(zs, hold ? Z_NO_FLUSH : Z_PARTIAL_FLUSH) ==
+		Z_STREAM_ERROR)
+	    {
+		eprintf("%s: deflate: %s", xsock->world->name,
+		    zs->msg ? zs->msg : "unknown");
 		return 0;
 	    }
-	} else
-#endif /* HAVE_SSL */
-	{
-	    numwritten = send(xsock->fd, str, numtowrite, 0);
-	    if (numwritten < 0) {
-		err = errno;
-		/* Socket is blocking; EAGAIN and EWOULDBLOCK are impossible. */
-		if (err == EINTR) {
-		    return 0;
-		} else if (err == EHOSTUNREACH || err == ENETUNREACH) {
-		    /* XXX there should be an UNREACHABLE hook here */
-		    eprintf("%s: send: %s", xsock->world->name, strerror(err));
-		    return 0;
-		} else {
-		    flushxsock();
-		    zombiesock(xsock); /* before hook, so state is correct */
-		    DISCON(xsock->world->name, "send", strerror(err));
-		    return 0;
-		}
-	    }
+	    if (!transmit_raw(zbuf, (char*)zs->next_out - zbuf, hold))
+		return 0;
+	    xsock->ozout += (char*)zs->next_out - zbuf;
+	} while (zs->avail_out == 0);
+	xsock->ozin += numtowrite;
+	return 1;
+    }
+#endif
+    return transmit_raw(str, numtowrite, hold);
+}
+
+/* Should output to xsock be held, and sent with the rest of this
+ * main_loop() pass's output in one write?
+ */
+static int hold_output(void)
+{
+    if (xsock->batched)
+	return 1;  /* keep it in order */
+    switch (send_batch) {
+    case BATCH_ON:	return 1;
+    case BATCH_BULK:	return xsock->sendpass == loop_pass;
+    default:		return 0;
+    }
+}
+
+/* Send the output that was held during this main_loop() pass. */
+static void flush_batches(void)
+{
+    Sock *sock, *oldxsock = xsock;
+
+    for (sock = hsock; sock && batched_socks; sock = sock->next) {
+	if (!sock->batched) continue;
+	sock->batched = 0;
+	batched_socks--;
+	if (sock->constate != SS_CONNECTED) continue;
+	xsock = sock;
+#if HAVE_MCCP
+	if (sock->ozstream) {
+	    char zbuf[BUFFSIZE];
+	    z_stream *zs = sock->ozstream;
+	    zs->next_in = NULL;
+	    zs->avail_in = 0;
+	    do {
+		zs->next_out = (Bytef*)zbuf;
+		zs->avail_out = sizeof(zbuf);
+		if (deflate(zs, Z_PARTIAL_FLUSH) == Z_STREAM_ERROR) break;
+		transmit_raw(zbuf, (char*)zs->next_out - zbuf, FALSE);
+		sock->ozout += (char*)zs->next_out - zbuf;
+	    } while (zs->avail_out == 0);
 	}
-        numtowrite -= numwritten;
-        str += numwritten;
-        gettime(&xsock->time[SOCK_SEND]);
+#endif
+	if (!sock->handshaking)
+	    flush_outqueue();  /* may kill sock */
+    }
+    xsock = oldxsock;
+}
+
+/* transmit bytes to current socket.  Whatever the socket won't accept now
+ * is queued, and sent from main_loop() when the socket becomes writable.
+ */
+static int transmit_raw(const char *str, unsigned int numtowrite, int hold)
+{
+    String *queue;
+    int numwritten = 0, backlog;
+
+    if (!xsock || xsock->constate != SS_CONNECTED)
+        return 0;
+    queue = xsock->outqueue;
+    if (hold) {
+	if (!xsock->batched) {
+	    xsock->batched = 1;
+	    batched_socks++;
+	}
+    } else {
+	xsock->sendpass = loop_pass;
+    }
+    if (!hold && xsock->outqueue_off == queue->len && !xsock->handshaking) {
+	/* nothing is queued, so try to write it directly */
+	if ((numwritten = sock_write(str, numtowrite)) < 0)
+	    return 0;
+	if (numwritten > 0)
+	    gettime(&xsock->time[SOCK_SEND]);
+	if (numwritten == numtowrite)
+	    return 1;
+    } else if (xsock->outqueue_off >= queue->len / 2) {
+	/* reclaim the space already sent */
+	memmove(queue->data, queue->data + xsock->outqueue_off,
+	    queue->len - xsock->outqueue_off);
+	Stringtrunc(queue, queue->len - xsock->outqueue_off);
+	xsock->outqueue_off = 0;
+    }
+    Stringfncat(queue, str + numwritten, numtowrite - numwritten);
+    if (!xsock->handshaking && !hold && !xsock->write_wants_read)
+	FD_SET(xsock->fd, &writers);
+
+    backlog = queue->len - xsock->outqueue_off;
+    if (hold && backlog >= BATCHMAX && !xsock->handshaking) {
+	/* a long pass shouldn't hold everything until it ends */
+	if (!flush_outqueue()) return 0;
+	backlog = queue->len - xsock->outqueue_off;
+    }
+    if (!xsock->backlogged && send_backlog > 0 && backlog >= send_backlog) {
+	xsock->backlogged = 1;
+	do_hook(H_BACKLOG, "%% Output to %s is backing up: %d bytes queued.",
+	    "%s %d", xsock->world->name, backlog);
     }
     return 1;
 }
@@ -2874,8 +3881,10 @@ int send_line(const char *src, unsigned int len, int eol_flag)
 
     if (xsock->flags & SOCKECHO)
         handle_socket_input(buffer2, i, "UTF-8");
-    if (xsock->constate == SS_CONNECTED)
+    if (xsock->constate == SS_CONNECTED) {
+	xsock->lines[SOCK_SEND]++;
         return transmit(buffer2, i);
+    }
     return 1;
 }
 
@@ -2890,6 +3899,7 @@ static void handle_socket_lines(void)
 	return;
     depth++;
     do {
+	xsock->qdepth--;
 	if (!xsock->queue.list.head) /* just dequeued the last line */
 	    socks_with_lines--;
 
@@ -2933,6 +3943,7 @@ static void handle_socket_lines(void)
 	    }
 
 	    world_output(xsock->world, CS(incoming_text));
+	    lat_add(&xsock->display_lat, &incoming_text->time);
 	    Stringfree(incoming_text);
 	}
     } while ((line = dequeue(&xsock->queue)));
@@ -3206,7 +4217,7 @@ static void f_telnet_recv(int cmd, int opt)
 }
 
 #if HAVE_MCCP
-static z_stream *new_zstream(void)
+static z_stream *new_zstream(Sock *sock)
 {
     z_stream *zstream;
     if (!(zstream = MALLOC(sizeof(z_stream))))
@@ -3214,13 +4225,84 @@ static z_stream *new_zstream(void)
     zstream->zalloc = Z_NULL;
     zstream->zfree = Z_NULL;
     zstream->opaque = Z_NULL;
-    if (inflateInit(zstream) == Z_OK)
+    zstream->next_in = Z_NULL;
+    zstream->avail_in = 0;
+    zstream->avail_out = 1;  /* not "window filled" */
+    if (inflateInit(zstream) == Z_OK) {
+	/* The output window grows in handle_socket_input() if the stream
+	 * inflates to more than it can hold at once. */
+	if (!sock->zbuffer) {
+	    sock->zbufsize = ZBUFFMIN;
+	    sock->zbuffer = XMALLOC(sock->zbufsize);
+	}
 	return zstream;
+    }
     if (zstream->msg)
 	eprintf("unable to start compressed stream: %s", zstream->msg);
     FREE(zstream);
     return NULL;
 }
+
+/* The server agreed to MCCP v3:  tell it that what follows is compressed,
+ * and start compressing. */
+static void start_mccp3(void)
+{
+    z_stream *zs;
+    STATIC_BUFFER(sb);
+
+    if (xsock->ozstream || !(zs = MALLOC(sizeof(z_stream))))
+	return;
+    zs->zalloc = Z_NULL;
+    zs->zfree = Z_NULL;
+    zs->opaque = Z_NULL;
+    if (deflateInit(zs, Z_DEFAULT_COMPRESSION) != Z_OK) {
+	if (zs->msg)
+	    eprintf("unable to start compressed stream: %s", zs->msg);
+	FREE(zs);
+	return;
+    }
+    Sprintf(sb, "%c%c%c%c%c", TN_IAC, TN_SB, TN_COMPRESS3, TN_IAC, TN_SE);
+    telnet_send(sb);
+    xsock->ozstream = zs;
+}
+
+/* Stop compressing output to sock.  If flush, end the stream properly, so
+ * the server knows that what follows is not compressed. */
+static void end_mccp3(Sock *sock, int flush)
+{
+    z_stream *zs = sock->ozstream;
+    char zbuf[BUFFSIZE];
+
+    if (!zs) return;
+    sock->ozstream = NULL;
+    if (flush && sock == xsock && sock->constate == SS_CONNECTED) {
+	zs->next_in = NULL;
+	zs->avail_in = 0;
+	do {
+	    zs->next_out = (Bytef*)zbuf;
+	    zs->avail_out = sizeof(zbuf);
+	    if (deflate(zs, Z_FINISH) == Z_STREAM_ERROR) break;
+	    transmit_raw(zbuf, (char*)zs->next_out - zbuf, FALSE);
+	    sock->ozout += (char*)zs->next_out - zbuf;
+	} while (zs->avail_out == 0);
+    }
+    deflateEnd(zs);
+    FREE(zs);
+}
+
+static void end_zstream(Sock *sock)
+{
+    if (sock->zstream) {
+	inflateEnd(sock->zstream);
+	FREE(sock->zstream);
+	sock->zstream = NULL;
+    }
+    if (sock->zbuffer) {
+	FREE(sock->zbuffer);
+	sock->zbuffer = NULL;
+	sock->zbufsize = 0;
+    }
+}
 #endif /* HAVE_MCCP */
 
 #if WIDECHAR
@@ -3251,18 +4333,24 @@ static int inbound_decode(String *output, const char *input, const char *iendptr
     const char *iptr = input;
 
     UChar outbufferUTF16[BUFFSIZE*4];
-    UChar *optr = outbufferUTF16;
+    UChar *optr;
     const UChar *oendptr = outbufferUTF16 + BUFFSIZE*4;
-    UErrorCode err16 = U_ZERO_ERROR;
+    UErrorCode err16;
 
-    char outbufferUTF8[BUFFSIZE*8];
-    UErrorCode err8 = U_ZERO_ERROR;
+    /* a UTF-16 unit is at most 3 bytes of UTF-8 */
+    char outbufferUTF8[BUFFSIZE*12];
+    UErrorCode err8;
     int32_t utf8written = 0;
 
     UBool flush = cflush ? TRUE : FALSE;
     
-    /* xcharset -> UTF-16 -> UTF-8 */
-    ucnv_toUnicode(conv, &optr, oendptr, &iptr, iendptr, NULL, flush, &err16);
+    /* xcharset -> UTF-16 -> UTF-8, a window at a time (an inflated chunk
+     * can be bigger than the window) */
+    do {
+	optr = outbufferUTF16;
+	err16 = U_ZERO_ERROR;
+	ucnv_toUnicode(conv, &optr, oendptr, &iptr, iendptr, NULL, flush,
+	    &err16);
 /*
 void ucnv_toUnicode 	( 	UConverter *  	converter,
 		UChar **  	target,
@@ -3274,7 +4362,9 @@ void ucnv_toUnicode 	( 	UConverter *  	converter,
 		UErrorCode *  	err 
 	)
 */
-    u_strToUTF8(outbufferUTF8, BUFFSIZE*8, &utf8written, outbufferUTF16, (int32_t)(optr - outbufferUTF16), &err8);
+	err8 = U_ZERO_ERROR;
+	u_strToUTF8(outbufferUTF8, sizeof(outbufferUTF8), &utf8written,
+	    outbufferUTF16, (int32_t)(optr - outbufferUTF16), &err8);
 /*
 char* u_strToUTF8 	( 	char *  	dest,
 		int32_t  	destCapacity,
@@ -3284,7 +4374,8 @@ char* u_strToUTF8 	( 	char *  	dest,
 		UErrorCode *  	pErrorCode 
 	) 	
 */
-    Stringfncat(output, outbufferUTF8, utf8written);
+	Stringfncat(output, outbufferUTF8, utf8written);
+    } while (err16 == U_BUFFER_OVERFLOW_ERROR && !U_FAILURE(err8));
     if (U_FAILURE(err16) || U_FAILURE(err8))
         core("inbound_decode U_FAILURE", __FILE__, __LINE__, 0);
     return (iptr - input); /* return number of input bytes consumed */
@@ -3301,9 +4392,6 @@ static int handle_socket_input(const char *simbuffer, int simlen, const char *en
 {
     char rawchar, localchar, inbuffer[BUFFSIZE];
     const char *incoming, *place;
-#if HAVE_MCCP
-    char mccpbuffer[BUFFSIZE];
-#endif
     fd_set readfds;
     int count, n, received = 0;
     struct timeval timeout;
@@ -3357,7 +4445,13 @@ static int handle_socket_input(const char *simbuffer, int simlen, const char *en
 #if HAVE_SSL
 	    if (xsock->ssl) {
 		count = SSL_read(xsock->ssl, inbuffer, sizeof(inbuffer));
-		if (count == 0 &&
+		if (count < 0 && (SSL_get_error(xsock->ssl, count) ==
+		    SSL_ERROR_WANT_READ || SSL_get_error(xsock->ssl, count) ==
+		    SSL_ERROR_WANT_WRITE))
+		{
+		    /* no application data yet (e.g., just a session ticket) */
+		    break;
+		} else if (count == 0 &&
 		    SSL_get_error(xsock->ssl, 0) == SSL_ERROR_SYSCALL &&
 		    ERR_peek_error() == 0)
 		{
@@ -3408,33 +4502,59 @@ static int handle_socket_input(const char *simbuffer, int simlen, const char *en
 		    return received;
 		}
 	    }
+	    if (count > 0) {
+		xsock->bytes[SOCK_RECV] += count;
+		xsock->calls[SOCK_RECV]++;
+	    }
 #if HAVE_MCCP
 	    if (xsock->zstream) {
 		int zret;
+		uInt avail_in;
+		struct timeval start, end;
 		if (count) {
 		    xsock->zstream->next_in = (Bytef*)inbuffer;
 		    xsock->zstream->avail_in = count;
 		}
-		xsock->zstream->next_out = (Bytef*)(incoming = mccpbuffer);
-		xsock->zstream->avail_out = sizeof(mccpbuffer);
-		zret = inflate(xsock->zstream, Z_PARTIAL_FLUSH);
+		avail_in = xsock->zstream->avail_in;
+		/* If the last inflate filled the window, the stream expands
+		 * faster than we take it, so widen the window.  Nothing in
+		 * zbuffer is live now. */
+		if (xsock->zstream->avail_out == 0 && xsock->zbufsize < ZBUFFMAX) {
+		    xsock->zbufsize *= 2;
+		    FREE(xsock->zbuffer);
+		    xsock->zbuffer = XMALLOC(xsock->zbufsize);
+		}
+		/* Inflate straight into the socket's buffer, in one call if
+		 * the window is big enough; it is telnet-parsed from there. */
+		xsock->zstream->next_out = (Bytef*)(incoming = xsock->zbuffer);
+		xsock->zstream->avail_out = xsock->zbufsize;
+		gettime(&start);
+		zret = inflate(xsock->zstream, Z_SYNC_FLUSH);
+		gettime(&end);
+		tvsub(&end, &end, &start);
+		tvadd(&xsock->ztime, &xsock->ztime, &end);
+		xsock->zin += avail_in - xsock->zstream->avail_in;
+		count = (char*)xsock->zstream->next_out - xsock->zbuffer;
+		xsock->zout += count;
 		switch (zret) {
 		case Z_OK:
-		    count = (char*)xsock->zstream->next_out - mccpbuffer;
 		    break;
 		case Z_STREAM_END:
-		    /* handle stuff inflated before stream end */
-		    /* NOTE: This could be partway into parsing a character!? */
-		    count = (char*)xsock->zstream->next_out - mccpbuffer;
-		    received += handle_socket_input(mccpbuffer, count, NULL);
 		    /* prepare to handle noncompressed stuff after stream end */
+		    avail_in = xsock->zstream->avail_in;
 		    incoming = (char*)xsock->zstream->next_in;
-		    count = xsock->zstream->avail_in;
-		    /* clean up zstream */
+		    /* clean up zstream first, so the recursion doesn't see
+		     * the leftover input as still compressed */
 		    inflateEnd(xsock->zstream);
 		    FREE(xsock->zstream);
 		    xsock->zstream = NULL;
 		    xsock->flags &= ~SOCKCOMPRESS;
+		    /* handle stuff inflated before stream end */
+		    /* NOTE: This could be partway into parsing a character!? */
+		    received += handle_socket_input(xsock->zbuffer, count, NULL);
+		    end_zstream(xsock);
+		    if (xsock->constate >= SS_ZOMBIE) return received;
+		    count = avail_in;
 		    break;
 		default:
 		    flushxsock();
@@ -3585,7 +4705,7 @@ static int handle_socket_input(const char *simbuffer, int simlen, const char *en
 #if HAVE_MCCP
 		if (xsock->flags & SOCKCOMPRESS && !xsock->zstream) {
 		    /* compression was just enabled. */
-		    xsock->zstream = new_zstream();
+		    xsock->zstream = new_zstream(xsock);
 		    if (!xsock->zstream) {
 			zombiesock(xsock);
 		    } else {
@@ -3610,6 +4730,7 @@ static int handle_socket_input(const char *simbuffer, int simlen, const char *en
 #if HAVE_MCCP
 		    (rawchar == TN_COMPRESS && mccp) ||
 		    (rawchar == TN_COMPRESS2 && mccp) ||
+		    (rawchar == TN_COMPRESS3 && mccp) ||
 #endif
 #if ENABLE_ATCP
 		    (rawchar == TN_ATCP && atcp) ||
@@ -3633,6 +4754,10 @@ static int handle_socket_input(const char *simbuffer, int simlen, const char *en
                     } else {
                         DO(rawchar);  /* acknowledge their request */
                     }
+#if HAVE_MCCP
+		    if (rawchar == TN_COMPRESS3)
+			start_mccp3();
+#endif
                 } else {
                     DONT(rawchar);    /* refuse their request */
                 }
@@ -3646,6 +4771,10 @@ static int handle_socket_input(const char *simbuffer, int simlen, const char *en
                     CLR_TELOPT(xsock, them_tog, rawchar);
                 } else {
                     CLR_TELOPT(xsock, them, rawchar);  /* set state */
+#if HAVE_MCCP
+		    if (rawchar == TN_COMPRESS3)
+			end_mccp3(xsock, TRUE);
+#endif
                     if (TELOPT(xsock, them_tog, rawchar)) { /* we requested */
                         CLR_TELOPT(xsock, them_tog, rawchar);  /* done */
                     } else {
@@ -3770,7 +4899,11 @@ non_telnet:
 
 	if (interrupted()) break;
 
-    } while (n > 0);
+    } while (n > 0
+#if HAVE_SSL
+	|| (xsock->ssl && SSL_pending(xsock->ssl))
+#endif
+	);
 
     test_prompt();
 
@@ -3783,6 +4916,7 @@ static void handle_socket_input_queue_lines(Sock *sock)
 {
     String *debug = sock->buffer;
     char *place;
+    char *start = sock->buffer->data;  /* first byte not yet queued */
     char *bufferend = sock->buffer->data + sock->buffer->len;
     char rawchar, localchar;
     char lastchar = '\0';
@@ -3796,11 +4930,8 @@ static void handle_socket_input_queue_lines(Sock *sock)
         if (rawchar == '\n') {
             /* Complete line received.  Queue it. */
             queue_socket_line(sock, CS(nextline), nextline->len, 0);
-            /* Shift to one past the end. */
-            Stringshift(sock->buffer, place - sock->buffer->data + 1);
+            start = place + 1;
             Stringtrunc(nextline, 0);
-            place = sock->buffer->data - 1;
-            bufferend = sock->buffer->data + sock->buffer->len;
 
         } else if (emulation == EMUL_DEBUG) {
             if (localchar != rawchar)
@@ -3820,10 +4951,8 @@ static void handle_socket_input_queue_lines(Sock *sock)
         {
             /* "*\b" is an LP editor prompt. */
             queue_socket_line(sock, CS(nextline), nextline->len, F_SERVPROMPT);
-            Stringshift(sock->buffer, place - sock->buffer->data + 1);
+            start = place + 1;
             Stringtrunc(nextline, 0);
-            place = sock->buffer->data - 1;
-            bufferend = sock->buffer->data + sock->buffer->len;
             /* other occurances of '\b' are handled by decode_ansi(), so
             * ansi codes aren't clobbered before they're interpreted */
 
@@ -3845,6 +4974,9 @@ static void handle_socket_input_queue_lines(Sock *sock)
         }
         lastchar = *place;
     } /* End of buffer-scanning for-loop */
+    /* Drop the queued lines from the buffer all at once; shifting after
+     * each line would make a big chunk quadratic. */
+    Stringshift(sock->buffer, start - sock->buffer->data);
     /* Shouldn't need to be here, but last lines get duplicated otherwise. */
     /* This implies something is wrong. */
     Stringtrunc(nextline, 0);
@@ -4076,10 +5208,145 @@ const char *world_info(const char *worldname, const char *fieldname)
 	    SSL_get_cipher_name(world->sock->ssl) :
 #endif
 	    "";
+#if HAVE_MCCP
+    } else if (strcmp("mccp_in", fieldname) == 0 ||
+	strcmp("mccp_out", fieldname) == 0 ||
+	strcmp("mccp_time", fieldname) == 0 ||
+	strcmp("mccp3_in", fieldname) == 0 ||
+	strcmp("mccp3_out", fieldname) == 0)
+    {
+	STATIC_BUFFER(buf);
+	Sock *sock = world->sock;
+	if (!sock)
+	    Stringcpy(buf, "");
+	else if (fieldname[4] == '3')
+	    Sprintf(buf, "%lu", fieldname[6] == 'i' ? sock->ozin : sock->ozout);
+	else if (fieldname[5] == 'i')
+	    Sprintf(buf, "%lu", sock->zin);
+	else if (fieldname[5] == 'o')
+	    Sprintf(buf, "%lu", sock->zout);
+	else
+	    Sprintf(buf, "%ld.%06ld", (long)sock->ztime.tv_sec,
+		(long)sock->ztime.tv_usec);
+	result = buf->data;
+#endif
     } else return NULL;
     return result ? result : "";
 }
 
+/* One statistic of lat, named by field:  "n", "avg", "max", or "pNN". */
+static Value *lat_value(const Latency *lat, const char *field)
+{
+    long usec;
+
+    if (strcmp(field, "n") == 0)
+	return newint(lat->n);
+    if (strcmp(field, "avg") == 0)
+	return newfloat(lat->n ? lat->total / lat->n : 0.0);
+    if (strcmp(field, "max") == 0)
+	usec = lat->max;
+    else if (field[0] == 'p' && is_digit(field[1]) &&
+	(!field[2] || (is_digit(field[2]) && !field[3])))
+	usec = lat_percentile(lat, atoi(field + 1));
+    else
+	return NULL;
+    return newdtime(usec / 1000000, usec % 1000000);
+}
+
+/* Value of the named per-socket statistic for worldname (or the current
+ * world), or NULL if fieldname is not valid. */
+struct Value *sockstat(const char *worldname, const char *fieldname)
+{
+    World *world;
+    Sock *sock;
+
+    world = worldname ? find_world(worldname) : xworld();
+    if (!world || !(sock = world->sock))
+	return shareval(val_blank); /* not an error */
+
+    if (strcmp("bytes_in", fieldname) == 0)
+	return newint(sock->bytes[SOCK_RECV]);
+    if (strcmp("bytes_out", fieldname) == 0)
+	return newint(sock->bytes[SOCK_SEND]);
+    if (strcmp("lines_in", fieldname) == 0)
+	return newint(sock->lines[SOCK_RECV]);
+    if (strcmp("lines_out", fieldname) == 0)
+	return newint(sock->lines[SOCK_SEND]);
+    if (strcmp("recvs", fieldname) == 0)
+	return newint(sock->calls[SOCK_RECV]);
+    if (strcmp("sends", fieldname) == 0)
+	return newint(sock->calls[SOCK_SEND]);
+    if (strcmp("queue", fieldname) == 0)
+	return newint(sock->qdepth);
+    if (strcmp("queue_max", fieldname) == 0)
+	return newint(sock->qmax);
+    if (strncmp("display_", fieldname, 8) == 0)
+	return lat_value(&sock->display_lat, fieldname + 8);
+    if (strncmp("key_", fieldname, 4) == 0)
+	return lat_value(&sock->key_lat, fieldname + 4);
+    return NULL;
+}
+
+static void print_latency(const char *label, const Latency *lat)
+{
+    long p50, p90, p99;
+
+    if (!lat->n) {
+	oprintf("  %-8s none", label);
+	return;
+    }
+    p50 = lat_percentile(lat, 50);
+    p90 = lat_percentile(lat, 90);
+    p99 = lat_percentile(lat, 99);
+    oprintf("  %-8s %lu, avg %.6f, p50 %ld.%06ld, p90 %ld.%06ld, "
+	"p99 %ld.%06ld, max %ld.%06ld", label, lat->n, lat->total / lat->n,
+	p50 / 1000000, p50 % 1000000, p90 / 1000000, p90 % 1000000,
+	p99 / 1000000, p99 % 1000000, lat->max / 1000000, lat->max % 1000000);
+}
+
+/* display I/O counters and latencies of open sockets. */
+struct Value *handle_sockstats_command(String *args, int offset)
+{
+    Sock *sock;
+    int count = 0;
+    Pattern pat_name;
+
+    init_pattern_str(&pat_name, NULL);
+    Stringstriptrail(args);
+    if (args->len > offset &&
+	!init_pattern(&pat_name, args->data + offset, matching))
+	return shareval(val_zero);
+
+    for (sock = hsock; sock; sock = sock->next) {
+	if (args->len > offset && !patmatch(&pat_name, NULL, sock->world->name))
+	    continue;
+	count++;
+	oprintf("%s:", sock->world->name);
+	oprintf("  in:      %lu bytes, %lu lines, %lu reads",
+	    sock->bytes[SOCK_RECV], sock->lines[SOCK_RECV],
+	    sock->calls[SOCK_RECV]);
+	oprintf("  out:     %lu bytes, %lu lines, %lu writes",
+	    sock->bytes[SOCK_SEND], sock->lines[SOCK_SEND],
+	    sock->calls[SOCK_SEND]);
+	oprintf("  queue:   %d lines, at most %d", sock->qdepth, sock->qmax);
+#if HAVE_MCCP
+	if (sock->zin)
+	    oprintf("  mccp:    %lu bytes inflated to %lu in %ld.%06lds",
+		sock->zin, sock->zout, (long)sock->ztime.tv_sec,
+		(long)sock->ztime.tv_usec);
+	if (sock->ozin)
+	    oprintf("  mccp3:   %lu bytes deflated to %lu",
+		sock->ozin, sock->ozout);
+#endif
+	print_latency("display:", &sock->display_lat);
+	print_latency("key:", &sock->key_lat);
+    }
+    free_pattern(&pat_name);
+    if (!count && !(args->len > offset))
+	eprintf("Not connected to any sockets.");
+    return newint(count);
+}
+
 int is_open(const char *worldname)
 {
     World *w;
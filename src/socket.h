@@ -19,6 +19,7 @@
 #define CONN_SSL	0x04
 #define CONN_BG		0x08
 #define CONN_FG		0x10
+#define CONN_NOWAIT	0x20	/* don't wait briefly for lookup or connect */
 
 extern String *incoming_text;
 extern int quit_flag;
@@ -33,7 +34,10 @@ extern void    readers_set(int fd);
 extern struct timeval *socktime(const char *name, int dir);
 extern int     tog_bg(Var *var);
 extern int     tog_keepalive(Var *var);
+extern int     ch_ssl(Var *var);
+extern int     ch_send_batch(Var *var);
 extern int     openworld(const char *name, const char *port, int flags);
+extern int     openworlds(const char *names, int flags);
 extern void    world_output(struct World *world, conString *line);
 extern int     send_line(const char *s, unsigned int len, int eol_flag);
 extern conString *fgprompt(void);
@@ -64,6 +68,7 @@ extern int	     have_active_socks(void);
 extern void          xsock_alert_id(void);
 extern const char   *fgname(void);
 extern const char   *world_info(const char *worldname, const char *fieldname);
+extern struct Value *sockstat(const char *worldname, const char *fieldname);
 extern struct World *named_or_current_world(const char *name);
 
 #endif /* SOCKET_H */
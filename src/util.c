@@ -66,6 +66,7 @@ struct feature features[] = {
     { "locale",		&feature_locale },
     { "MCCPv1",		&feature_MCCPv1 },
     { "MCCPv2",		&feature_MCCPv2 },
+    { "MCCPv3",		&feature_MCCPv3 },
     { "process",	&feature_process },
     { "SOCKS",		&feature_SOCKS },
     { "ssl",		&feature_ssl },
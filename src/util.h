@@ -64,6 +64,7 @@ extern const int feature_IPv6;
 extern const int feature_locale;
 extern const int feature_MCCPv1;
 extern const int feature_MCCPv2;
+extern const int feature_MCCPv3;
 extern const int feature_process;
 extern const int feature_SOCKS;
 extern const int feature_ssl;
@@ -53,7 +53,7 @@ static void   init_special_variable(Var *var, const char *cval,
 #define findglobalvar(name) \
 	(Var*)hashed_find(name, hash_string(name), var_table)
 
-#define HASH_SIZE 997    /* prime number */
+#define HASH_SIZE 1024   /* initial size; grows as needed */
 
 static List localvar[1];          /* local variables */
 static HashTable var_table[1];    /* global variables */
@@ -61,6 +61,16 @@ static int envsize;
 static int envmax;
 static int setting_nearest = 0;
 
+/* var_generation changes whenever a variable is created or destroyed, which
+ * are the only events that can change which variable a name refers to.
+ * An identifier Value caches the result of its last successful lookup
+ * along with the generation, so repeated references (e.g., in a /while
+ * loop) skip the scope and hash table searches until something changes.
+ * It is always even, and macro_generation always odd, so a cached macro
+ * is never mistaken for a variable (see ValueUnion.id).
+ */
+static unsigned int var_generation = 2;
+
 #define bicode(a, b)  b 
 #include "enumlist.h"
 
@@ -93,15 +103,16 @@ extern char **environ;
 #define VARSPECIAL 0002	/* has special meaning to tf */
 #define VAREXPORT  0004	/* exported to environment */
 #define VARAUTOX   0010	/* automatically exported to environment */
+#define VARGLOBAL  0020	/* is in var_table */
 
 
 /* Special variables. */
 Var special_var[] = {
 #define varcode(id, name, sval, type, flags, enums, ival, uval, func) \
-    {{ name, type, 1, NULL }, flags|VARSPECIAL, enums, func, NULL, 0 },
+    {{ name, type, 1, NULL }, flags|VARSPECIAL, enums, func, 0 },
 #include "varlist.h"
 #undef varcode
-    {{ NULL, 0, 1, NULL }, 0, NULL, NULL, NULL, 0 }
+    {{ NULL, 0, 1, NULL }, 0, NULL, NULL, 0 }
 };
 
 Pattern looks_like_special_sub;    /* looks like a special substitution */
@@ -111,7 +122,8 @@ inline Var *newglobalvar(const char *name)
 {
     Var *var;
     var = newvar(name);
-    var->node = hash_insert((void*)var, var_table);
+    hash_insert((void*)var, var_table);
+    var->flags |= VARGLOBAL;
     if (setting_nearest && pedantic) {
 	tf_wprintf("variable '%s' was not previously defined in any "
 	    "scope, so it has been created in the global scope.", name);
@@ -122,6 +134,7 @@ inline Var *newglobalvar(const char *name)
 static void init_special_variable(Var *var,
     const char *cval, long ival, long uval)
 {
+    var->val.name = intern(var->val.name, -1);
     var->val.sval = NULL;
     var->flags |= VARSET;
     switch (var->val.type & TYPES_BASIC) {
@@ -148,7 +161,8 @@ static void init_special_variable(Var *var,
     default:
         break;
     }
-    var->node = hash_insert((void *)var, var_table);
+    hash_insert((void *)var, var_table);
+    var->flags |= VARGLOBAL;
 }
 
 /* initialize structures for variables */
@@ -159,7 +173,7 @@ void init_variables(void)
     const char *oldcommand;
     Var *var;
 
-    init_hashtable(var_table, HASH_SIZE, strstructcmp);
+    init_hashtable(var_table, "variables", HASH_SIZE, strstructcmp);
     init_list(localvar);
 
     init_pattern(&looks_like_special_sub,
@@ -208,7 +222,10 @@ void init_variables(void)
 	} else {
 	    /* Shouldn't happen unless environment contained same name twice */
 	    set_str_var_direct(var, TYPE_STR, svalue);
-	    if (!var->node) var->node = hash_insert((void *)var, var_table);
+	    if (!(var->flags & VARGLOBAL)) {
+		hash_insert((void *)var, var_table);
+		var->flags |= VARGLOBAL;
+	    }
         }
         if (cvalue) *--cvalue = '=';  /* restore '=' */
         var->flags |= VAREXPORT;
@@ -233,9 +250,10 @@ void popvarscope(void)
         var = (Var *)unlist(level->head, level);
 	assert(var->val.count == 1);
 	clearval(&var->val);
-	FREE(var->val.name);
+	unintern(var->val.name);
 	var->val.name = NULL;
 	FREE(var);
+	var_generation += 2;
     }
 }
 
@@ -244,7 +262,8 @@ static Var *findlevelvar(const char *name, List *level)
     ListEntry *node;
 
     for (node = level->head; node; node = node->next) {
-        if (strcmp(name, ((Var *)node->datum)->val.name) == 0) break;
+        const char *varname = ((Var *)node->datum)->val.name;
+        if (varname == name || strcmp(name, varname) == 0) break;
     }
     return node ? (Var *)node->datum : NULL;
 }
@@ -292,9 +311,13 @@ Var *hfindnearestvar(const Value *idval)
 {
     const char *name = idval->name;
     Var *var;
+    Value *cache = (Value *)idval;  /* only the lookup cache is modified */
+
+    if (idval->u.id.ref.var && idval->u.id.gen == var_generation)
+	return idval->u.id.ref.var;
 
     if (!(var = findlocalvar(name)) &&
-	!(var = hfindglobalvar(name, idval->u.hash)))
+	!(var = hfindglobalvar(name, idval->u.id.hash)))
     {
         if (patmatch(&looks_like_special_sub, NULL, name)) {
             tf_wprintf("\"%s\" in an expression is a variable reference, "
@@ -303,6 +326,8 @@ Var *hfindnearestvar(const Value *idval)
         }
         return NULL;
     }
+    cache->u.id.ref.var = var;
+    cache->u.id.gen = var_generation;
     return var;
 }
 
@@ -324,9 +349,16 @@ Var *hsetnearestvar(const Value *idval, conString *value)
 {
     Var *var;
     const char *name = idval->name;
-    unsigned int hash = idval->u.hash;
+    unsigned int hash = idval->u.id.hash;
 
-    if ((var = findlocalvar(name))) {
+    if (idval->u.id.ref.var && idval->u.id.gen == var_generation) {
+	/* globals are always in var_table; locals never are */
+	var = idval->u.id.ref.var;
+	if (var->flags & VARGLOBAL) var = NULL;
+    } else {
+	var = findlocalvar(name);
+    }
+    if (var) {
         set_str_var_direct(var, TYPE_STR, value);
     } else {
         setting_nearest++;
@@ -341,7 +373,7 @@ static Var *newvar(const char *name)
     Var *var;
 
     var = (Var *)XMALLOC(sizeof(Var));
-    var->node = NULL;
+    var_generation += 2;
     var->val.type = 0;
     var->val.count = 1;
     var->val.sval = NULL;
@@ -352,7 +384,7 @@ static Var *newvar(const char *name)
     var->statuses = 0;
     var->statusfmts = 0;
     var->statusattrs = 0;
-    var->val.name = STRDUP(name);
+    var->val.name = intern(name, -1);
 
     if (patmatch(&looks_like_special_sub, NULL, name)) {
 	tf_wprintf("\"%s\" conflicts with the name of a special "
@@ -789,9 +821,10 @@ void freevar(Var *var)
     if (var->flags & (VARSET | VARSPECIAL) || var->statuses ||
 	var->statusfmts || var->statusattrs)
 	    return;
-    hash_remove(var->node, var_table);
-    FREE(var->val.name);
+    hash_remove(var, var_table);
+    unintern(var->val.name);
     FREE(var);
+    var_generation += 2;
 }
 
 /*********/
@@ -872,7 +905,10 @@ static int set_special_var(Var *var, Value *value, int funcflag,
     }
 
     var->flags |= VARSET;
-    if (!var->node) var->node = hash_insert((void *)var, var_table);
+    if (!(var->flags & VARGLOBAL)) {
+	hash_insert((void *)var, var_table);
+	var->flags |= VARGLOBAL;
+    }
     set_env_var(var, exportflag);
 
     if (funcflag && var->func) {
@@ -909,7 +945,6 @@ static int listvar(
     int shortflag)
 {
     int i;
-    ListEntry *node;
     Var *var;
     Pattern pname, pvalue;
     Vector vars = vector_init(1024);
@@ -927,17 +962,13 @@ static int listvar(
 
     /* collect matching variables */
     for (i = 0; i < var_table->size; i++) {
-        if (var_table->bucket[i]) {
-            for (node = var_table->bucket[i]->head; node; node = node->next) {
-                var = (Var*)node->datum;
-                if (!(var->flags & VARSET)) continue;
-                if (exportflag >= 0 && !(var->flags & VAREXPORT) != !exportflag)                    continue;
-                if (name && !patmatch(&pname, NULL, var->val.name)) continue;
-                if (!var->val.sval) valstr(&var->val); /* force sval to exist */
-                if (value && !patmatch(&pvalue, var->val.sval, NULL)) continue;
-		vector_add(&vars, node->datum);
-            }
-        }
+        if (!(var = (Var*)var_table->slot[i].datum)) continue;
+        if (!(var->flags & VARSET)) continue;
+        if (exportflag >= 0 && !(var->flags & VAREXPORT) != !exportflag)            continue;
+        if (name && !patmatch(&pname, NULL, var->val.name)) continue;
+        if (!var->val.sval) valstr(&var->val); /* force sval to exist */
+        if (value && !patmatch(&pvalue, var->val.sval, NULL)) continue;
+        vector_add(&vars, var);
     }
 
     vector_sort(&vars, strpppcmp);
@@ -988,20 +1019,18 @@ void free_vars(void)
     FREE(environ);
 
     for (i = 0; i < NUM_VARS; i++) {
-        if (special_var[i].node) hash_remove(special_var[i].node, var_table);
+        if (special_var[i].flags & VARGLOBAL)
+	    hash_remove(&special_var[i], var_table);
         clearval(&special_var[i].val);
-	/* var and var->val.name are static, can't be freed */
+	unintern(special_var[i].val.name);
+	/* var is static, can't be freed */
     }
 
     for (i = 0; i < var_table->size; i++) {
-        if (var_table->bucket[i]) {
-            while (var_table->bucket[i]->head) {
-                var = (Var *)unlist(var_table->bucket[i]->head,
-		    var_table->bucket[i]);
-		clearval(&var->val);
-		FREE(var->val.name);
-                FREE(var);
-            }
+        if ((var = (Var *)var_table->slot[i].datum)) {
+	    clearval(&var->val);
+	    unintern(var->val.name);
+	    FREE(var);
         }
     }
     free_hash(var_table);
@@ -75,9 +75,12 @@ varstr (VAR_default_charset, "default_charset", "UTF-8", ch_default_charset)
 #endif
 varflag(VAR_cleardone,	"cleardone",	FALSE,		NULL)
 varflag(VAR_clearfull,	"clearfull",	FALSE,		NULL)
+varint (VAR_compile_cache,"compile_cache",	64,		ch_compile_cache)
 varenum(VAR_async_conn,	"connect",	TRUE,		NULL,	enum_block)
+vartime(VAR_connect_delay,"connect_delay",	0,250000,	NULL)
 varflag(VAR_defcompile,	"defcompile",	FALSE,		NULL)
 varenum(VAR_emulation,	"emulation",	EMUL_ANSI_ATTR,	NULL,	enum_emul)
+varint (VAR_encode_cache,"encode_cache",	65536,		ch_encode_cache)
 varstr (VAR_error_attr,	"error_attr",	NULL,		ch_attr)
 varflag(VAR_expand_tabs,"expand_tabs",	TRUE,		NULL)
 varflag(VAR_expnonvis,	"expnonvis",	FALSE,		ch_expnonvis)
@@ -109,6 +112,7 @@ varflag(VAR_lp,		"lp",		FALSE,		tog_lp)
 varflag(VAR_lpquote,	"lpquote",	FALSE,		ch_lpquote)
 vartime(VAR_maildelay,	"maildelay",	60,0,		ch_maildelay)
 varenum(VAR_matching,	"matching",	1,		NULL,	enum_match)
+varint (VAR_max_connecting,"max_connecting",8,		NULL)
 varint (VAR_max_hook,	"max_hook",	1000,		NULL)
 varint (VAR_max_instr,	"max_instr",	1000000,	NULL)
 varint (VAR_max_kbnum,	"max_kbnum",	999,		NULL)
@@ -124,6 +128,7 @@ varstr (VAR_mecho_attr,	"mecho_attr",	NULL,		ch_attr)
 varenum(VAR_meta_esc,	"meta_esc",	META_NONPRINT,	NULL,	enum_meta)
 varflag(VAR_more,	"more",		FALSE,		tog_more)
 varstr (VAR_mprefix,	"mprefix",	"+",		NULL)
+vartime(VAR_name_cache,"name_cache",	60,0,		NULL)
 varflag(VAR_oldslash,	"oldslash",	TRUE,		NULL)
 varflag(VAR_optimize,	"optimize",	TRUE,		NULL)
 varflag(VAR_pedantic,	"pedantic",	FALSE,		NULL)
@@ -143,18 +148,21 @@ varint (VAR_refreshtime,"refreshtime",	100000,		NULL)
 varflag(VAR_scroll,	"scroll",	FALSE,		ch_visual)
 varflag(VAR_secho,	"secho",	FALSE,		NULL)
 varstr (VAR_secho_attr,	"secho_attr",	NULL,		ch_attr)
+varint (VAR_send_backlog,"send_backlog",65536,		NULL)
+varenum(VAR_send_batch,"send_batch",	BATCH_BULK,	ch_send_batch,	enum_send_batch)
 varflag(VAR_shpause,	"shpause",	TRUE,		NULL)
 varpos (VAR_sidescroll,	"sidescroll",	999999,		NULL)
 varint (VAR_sigfigs,	"sigfigs",	15,		NULL)
 varflag(VAR_snarf,	"snarf",	FALSE,		NULL)
 varflag(VAR_sockmload,	"sockmload",	FALSE,		NULL)
 varstr (VAR_sprefix,	"sprefix",	NULL,		NULL)
-varstr (VAR_ssl_ca_dir,	"ssl_ca_dir",	NULL,		NULL)
-varstr (VAR_ssl_ca_file,"ssl_ca_file",	NULL,		NULL)
+varstr (VAR_ssl_ca_dir,	"ssl_ca_dir",	NULL,		ch_ssl)
+varstr (VAR_ssl_ca_file,"ssl_ca_file",	NULL,		ch_ssl)
 varflag(VAR_ssl_continue,"ssl_continue",TRUE,		NULL)
 varint (VAR_ssl_depth,	"ssl_depth",	10,		NULL)
 varflag(VAR_ssl_verbose,"ssl_verbose",	TRUE,		NULL)
-varflag(VAR_ssl_insecure,"ssl_insecure",FALSE,          NULL)
+varstr (VAR_ssl_session_file,"ssl_session_file",NULL,	ch_ssl)
+varflag(VAR_ssl_insecure,"ssl_insecure",FALSE,          ch_ssl)
 varstr (VAR_stat_attr,	"status_attr",	NULL,		ch_status_attr)
 varstr (VAR_stat_fields,"status_fields",NULL,		ch_status_fields)
 varpos (VAR_stat_height,"status_height",1,		ch_status_height)
@@ -47,7 +47,7 @@ World *defaultworld = NULL;
 
 static void free_world(World *w)
 {
-    if (w->name)      FREE(w->name);
+    if (w->name)      unintern(w->name);
     if (w->character) FREE(w->character);
     if (w->pass)      FREE(w->pass);
     if (w->host)      FREE(w->host);
@@ -114,7 +114,7 @@ World *new_world(const char *name, const char *type,
         if (defaultworld) {
 	    /* redefine existing default world */
             result = defaultworld;
-            FREE(defaultworld->name);
+            unintern(defaultworld->name);
             is_redef = TRUE;
         } else {
 	    /* define default world */
@@ -123,7 +123,7 @@ World *new_world(const char *name, const char *type,
 
     } else if (name && (result = find_world(name))) {
 	/* redefine existing world */
-        FREE(result->name);
+        unintern(result->name);
         is_redef = TRUE;
 
     } else {
@@ -145,10 +145,10 @@ World *new_world(const char *name, const char *type,
     }
 
     if (name) {
-        result->name = STRDUP(name);
+        result->name = intern(name, -1);
     } else {
         sprintf(buffer, "(unnamed%d)", unnamed++);
-        result->name = STRDUP(buffer);
+        result->name = intern(buffer, -1);
     }
 
 #define setfield(field) \
@@ -417,9 +417,19 @@ struct Value *handle_saveworld_command(String *args, int offset)
 World *find_world(const char *name)
 {
     World *p;
+    unsigned int hash;
 
     if (!name || !*name) return hworld;
-    for (p=hworld; p && (!p->name || cstrcmp(name, p->name) != 0); p = p->next);
+    /* world names are interned, so their hashes are precomputed */
+    hash = hash_string(name);
+    for (p = hworld; p; p = p->next) {
+        if (p->name == name) break;
+        if (p->name && interned_hash(p->name) == hash &&
+            cstrcmp(name, p->name) == 0)
+        {
+            break;
+        }
+    }
     return p;
 }
 
@@ -15,7 +15,7 @@
 #define WORLD_ECHO	010
 
 struct World {          /* World structure */
-    char *name;                 /* name of world - first, for cstrpppcmp */
+    const char *name;           /* name of world - first, for cstrpppcmp */
     int flags;
     struct World *next;
     char *character;            /* login name */